@@ -14,13 +14,29 @@
 #ifndef PYTHONCAPI_COMPAT
 #define PYTHONCAPI_COMPAT
 
+#include <Python.h>
+#include "frameobject.h"          // PyFrameObject, PyFrame_GetBack()
+
+// System headers used by PyMutex, see below. Include them outside the
+// extern "C" block.
+#if (PY_VERSION_HEX < 0x030D00B3 \
+     && (defined(__ATOMIC_ACQUIRE) || defined(_MSC_VER)))
+#  if defined(__linux__)
+#    include <linux/futex.h>      // FUTEX_WAIT_PRIVATE
+#    include <sched.h>            // sched_yield()
+#    include <sys/syscall.h>      // SYS_futex
+#    include <unistd.h>           // syscall()
+#  elif defined(_MSC_VER)
+#    include <intrin.h>           // _InterlockedCompareExchange()
+#  elif !defined(_WIN32)
+#    include <sched.h>            // sched_yield()
+#  endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#include <Python.h>
-#include "frameobject.h"          // PyFrameObject, PyFrame_GetBack()
-
 
 // Compatibility with Visual Studio 2013 and older which don't support
 // the inline keyword in C (only in C++): use __inline instead.
@@ -146,6 +162,242 @@ _Py_SET_SIZE(PyVarObject *ob, Py_ssize_t size)
 #endif
 
 
+// If PYTHONCAPI_COMPAT_STATS is defined, count calls to functions having
+// a slow path, and how many calls take the slow path: see PyCompat_GetStats().
+// Each C file including pythoncapi_compat.h has its own counters.
+#define _PyCompat_STAT_FROMSTRING 0
+#define _PyCompat_STAT_VECTORCALL 1
+#define _PyCompat_STAT_GETOPTIONALATTR 2
+#define _PyCompat_STAT_GETOPTIONALITEM 3
+#define _PyCompat_STAT_FRAME_GETVAR 4
+#define _PyCompat_STAT_CODE_ADDR2LINE 5
+#define _PyCompat_STAT_CODE_GETNAMES 6
+#define _PyCompat_STAT_FLOAT_PACKARRAY8 7
+#define _PyCompat_STAT_FLOAT_UNPACKARRAY8 8
+#define _PyCompat_STAT_MUTEX_LOCK 9
+#define _PyCompat_NSTAT 10
+
+#ifdef PYTHONCAPI_COMPAT_STATS
+typedef struct {
+    size_t calls;
+    size_t slow;
+} _PyCompat_Stat;
+
+PYCAPI_COMPAT_STATIC_INLINE(_PyCompat_Stat*)
+_PyCompat_GetStatArray(void)
+{
+    static _PyCompat_Stat stats[_PyCompat_NSTAT];
+    return stats;
+}
+
+// Use relaxed atomic operations if available. Otherwise, rely on the GIL,
+// or use Python atomic functions on the free-threaded build.
+#ifdef __ATOMIC_RELAXED
+#  define _PyCompat_STAT_ADD(var) \
+       ((void)__atomic_fetch_add(&(var), 1, __ATOMIC_RELAXED))
+#  define _PyCompat_STAT_LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#  define _PyCompat_STAT_CLEAR(var) \
+       __atomic_store_n(&(var), 0, __ATOMIC_RELAXED)
+#elif defined(Py_GIL_DISABLED)
+#  define _PyCompat_STAT_ADD(var) \
+       ((void)_Py_atomic_add_ssize(_Py_CAST(Py_ssize_t*, &(var)), 1))
+#  define _PyCompat_STAT_LOAD(var) \
+       _Py_CAST(size_t, _Py_atomic_load_ssize_relaxed( \
+                            _Py_CAST(Py_ssize_t*, &(var))))
+#  define _PyCompat_STAT_CLEAR(var) \
+       _Py_atomic_store_ssize_relaxed(_Py_CAST(Py_ssize_t*, &(var)), 0)
+#else
+#  define _PyCompat_STAT_ADD(var) ((void)(var)++)
+#  define _PyCompat_STAT_LOAD(var) (var)
+#  define _PyCompat_STAT_CLEAR(var) ((var) = 0)
+#endif
+
+#  define _PyCompat_STAT_CALL(stat) \
+       _PyCompat_STAT_ADD(_PyCompat_GetStatArray()[stat].calls)
+#  define _PyCompat_STAT_SLOW(stat) \
+       _PyCompat_STAT_ADD(_PyCompat_GetStatArray()[stat].slow)
+
+// Get statistics: return a dict of name => (calls, slow) where calls is the
+// number of calls and slow is the number of calls taking the slow path.
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyCompat_GetStats(void)
+{
+    static const char* const names[_PyCompat_NSTAT] = {
+        "_PyCompat_FromString",
+        "PyObject_Vectorcall",
+        "PyObject_GetOptionalAttr",
+        "PyMapping_GetOptionalItem",
+        "PyFrame_GetVar",
+        "PyCompat_Code_Addr2Line",
+        "PyCompat_Code_GetVarnames",
+        "PyCompat_Float_PackArray8",
+        "PyCompat_Float_UnpackArray8",
+        "PyMutex_Lock",
+    };
+    _PyCompat_Stat *stats = _PyCompat_GetStatArray();
+    PyObject *dict, *value;
+    int i, res;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < _PyCompat_NSTAT; i++) {
+        value = Py_BuildValue("(nn)",
+                    _Py_CAST(Py_ssize_t, _PyCompat_STAT_LOAD(stats[i].calls)),
+                    _Py_CAST(Py_ssize_t, _PyCompat_STAT_LOAD(stats[i].slow)));
+        if (value == NULL) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        res = PyDict_SetItemString(dict, names[i], value);
+        Py_DECREF(value);
+        if (res < 0) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+    return dict;
+}
+
+// Reset statistics
+PYCAPI_COMPAT_STATIC_INLINE(void)
+PyCompat_ResetStats(void)
+{
+    _PyCompat_Stat *stats = _PyCompat_GetStatArray();
+    int i;
+    for (i = 0; i < _PyCompat_NSTAT; i++) {
+        _PyCompat_STAT_CLEAR(stats[i].calls);
+        _PyCompat_STAT_CLEAR(stats[i].slow);
+    }
+}
+#else
+#  define _PyCompat_STAT_CALL(stat) ((void)0)
+#  define _PyCompat_STAT_SLOW(stat) ((void)0)
+#endif
+
+
+// Create a string from a UTF-8 encoded C string: return a new reference.
+//
+// If PYTHONCAPI_COMPAT_STRING_CACHE is defined, keep a small cache of
+// interned strings indexed by the C string address, to only decode and hash
+// each string once. The C string can be modified or its memory reused after
+// the call: a cache hit also compares the C string to the cached string.
+//
+// The cache is not thread-safe: it's not used on the free-threaded build, nor
+// by subinterpreters since Python 3.12.
+#ifndef PYTHONCAPI_COMPAT_STRING_CACHE_SIZE
+#  define PYTHONCAPI_COMPAT_STRING_CACHE_SIZE 64
+#endif
+
+#if defined(PYTHONCAPI_COMPAT_STRING_CACHE) && !defined(Py_GIL_DISABLED)
+#  define _PyCompat_STRING_CACHE
+#endif
+
+#ifdef _PyCompat_STRING_CACHE
+typedef struct {
+    const char *str;
+    PyInterpreterState *interp;  // interpreter which created obj
+    PyObject *obj;
+    const char *utf8;  // UTF-8 encoded obj, owned by obj
+} _PyCompat_StringCacheEntry;
+
+typedef struct {
+    // 0: the Py_AtExit() callback is not registered yet, 1: registered,
+    // -1: the cache is disabled
+    int atexit;
+    _PyCompat_StringCacheEntry entries[PYTHONCAPI_COMPAT_STRING_CACHE_SIZE];
+} _PyCompat_StringCache;
+
+PYCAPI_COMPAT_STATIC_INLINE(_PyCompat_StringCache*)
+_PyCompat_GetStringCache(void)
+{
+    static _PyCompat_StringCache cache;
+    return &cache;
+}
+
+// Py_AtExit() callback: Py_Finalize() deleted cached strings
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_StringCache_Clear(void)
+{
+    memset(_PyCompat_GetStringCache(), 0, sizeof(_PyCompat_StringCache));
+}
+#endif
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+_PyCompat_FromString(const char *str)
+{
+#ifdef _PyCompat_STRING_CACHE
+    _PyCompat_StringCache *cache = _PyCompat_GetStringCache();
+    Py_uintptr_t addr = _Py_CAST(Py_uintptr_t, str);
+    size_t index = _Py_CAST(size_t, (addr >> 4) ^ addr)
+                   % PYTHONCAPI_COMPAT_STRING_CACHE_SIZE;
+    _PyCompat_StringCacheEntry *entry = &cache->entries[index];
+    PyInterpreterState *interp = PyThreadState_GET()->interp;
+    PyObject *obj;
+    const char *utf8;
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_FROMSTRING);
+#if PY_VERSION_HEX >= 0x030C0000
+    // Since Python 3.12, a subinterpreter can have its own GIL and so run in
+    // parallel with the main interpreter, and since Python 3.13, interned
+    // strings belong to an interpreter: only the main interpreter reads and
+    // fills the cache.
+    if (interp != PyInterpreterState_Main()) {
+        _PyCompat_STAT_SLOW(_PyCompat_STAT_FROMSTRING);
+        return PyUnicode_InternFromString(str);
+    }
+#endif
+    if (entry->str == str && entry->interp == interp
+        && strcmp(entry->utf8, str) == 0)
+    {
+        return Py_NewRef(entry->obj);
+    }
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_FROMSTRING);
+#if PY_VERSION_HEX >= 0x03000000
+    obj = PyUnicode_InternFromString(str);
+#else
+    obj = PyString_InternFromString(str);
+#endif
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    if (cache->atexit == 0) {
+        cache->atexit = (Py_AtExit(_PyCompat_StringCache_Clear) == 0 ? 1 : -1);
+    }
+    if (cache->atexit < 0) {
+        return obj;
+    }
+#if PY_VERSION_HEX >= 0x03030000
+    utf8 = PyUnicode_AsUTF8(obj);
+#elif PY_VERSION_HEX >= 0x03000000
+    utf8 = _PyUnicode_AsString(obj);
+#else
+    utf8 = PyString_AS_STRING(obj);
+#endif
+    if (utf8 == NULL) {
+        PyErr_Clear();
+        return obj;
+    }
+    // Before Python 3.13, interned strings are shared by all interpreters
+    Py_XSETREF(entry->obj, Py_NewRef(obj));
+    entry->str = str;
+    entry->interp = interp;
+    entry->utf8 = utf8;
+    return obj;
+#else
+    _PyCompat_STAT_CALL(_PyCompat_STAT_FROMSTRING);
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_FROMSTRING);
+#if PY_VERSION_HEX >= 0x03000000
+    return PyUnicode_FromString(str);
+#else
+    return PyString_FromString(str);
+#endif
+#endif
+}
+
+
 // bpo-40421 added PyFrame_GetCode() to Python 3.9.0b1
 #if PY_VERSION_HEX < 0x030900B1 || defined(PYPY_VERSION)
 PYCAPI_COMPAT_STATIC_INLINE(PyCodeObject*)
@@ -160,9 +412,16 @@ PyFrame_GetCode(PyFrameObject *frame)
 PYCAPI_COMPAT_STATIC_INLINE(PyCodeObject*)
 _PyFrame_GetCodeBorrow(PyFrameObject *frame)
 {
+#if PY_VERSION_HEX < 0x030B0000 || defined(PYPY_VERSION)
+    // Read the PyFrameObject member: don't touch the reference count
+    assert(frame != _Py_NULL);
+    assert(frame->f_code != _Py_NULL);
+    return frame->f_code;
+#else
     PyCodeObject *code = PyFrame_GetCode(frame);
     Py_DECREF(code);
     return code;
+#endif
 }
 
 
@@ -180,9 +439,15 @@ PyFrame_GetBack(PyFrameObject *frame)
 PYCAPI_COMPAT_STATIC_INLINE(PyFrameObject*)
 _PyFrame_GetBackBorrow(PyFrameObject *frame)
 {
+#if PY_VERSION_HEX < 0x030B0000
+    // Read the PyFrameObject member: don't touch the reference count
+    assert(frame != _Py_NULL);
+    return frame->f_back;
+#else
     PyFrameObject *back = PyFrame_GetBack(frame);
     Py_XDECREF(back);
     return back;
+#endif
 }
 #endif
 
@@ -244,13 +509,127 @@ PyFrame_GetLasti(PyFrameObject *frame)
 #endif
 
 
+// If PYTHONCAPI_COMPAT_FAST_LOCALS is defined, PyFrame_GetVar() reads
+// variables of optimized frames from the fast locals on Python 3.10 and older,
+// rather than calling PyFrame_FastToLocalsWithError() and creating the frame
+// locals dictionary.
+#if (defined(PYTHONCAPI_COMPAT_FAST_LOCALS) && PY_VERSION_HEX < 0x030B0000 \
+     && !defined(PYPY_VERSION))
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_NameEqual(PyObject *var_name, PyObject *name)
+{
+    if (var_name == name) {
+        return 1;
+    }
+#if PY_VERSION_HEX >= 0x03000000
+    // Variable names are interned by PyCode_New(): two different interned
+    // strings are not equal.
+    if (PyUnicode_CHECK_INTERNED(var_name) && PyUnicode_CHECK_INTERNED(name)) {
+        return 0;
+    }
+    if (PyUnicode_IS_READY(name)
+        && PyUnicode_GET_LENGTH(var_name) != PyUnicode_GET_LENGTH(name)) {
+        return 0;
+    }
+    return (PyUnicode_Compare(var_name, name) == 0);
+#else
+    return (PyString_GET_SIZE(var_name) == PyString_GET_SIZE(name)
+            && memcmp(PyString_AS_STRING(var_name), PyString_AS_STRING(name),
+                      _Py_CAST(size_t, PyString_GET_SIZE(name))) == 0);
+#endif
+}
+
+// Look up a variable in the fast locals of a frame: local variables, then cell
+// variables, then free variables. The last match wins, as in
+// PyFrame_FastToLocalsWithError().
+//
+// Return 1 and set *value to a borrowed reference if the variable is found
+// (NULL if the variable is unbound). Return 0 if the name is not a variable of
+// the code. Return -1 if the frame has no fast locals, or if name is not
+// a string.
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Frame_GetFastVar(PyFrameObject *frame, PyObject *name,
+                           PyObject **value)
+{
+    PyCodeObject *code = frame->f_code;
+    PyObject **fast = frame->f_localsplus;
+    PyObject *names[3];
+    Py_ssize_t i, n, kind;
+    int found = 0;
+
+    *value = NULL;
+#if PY_VERSION_HEX >= 0x03000000
+    if (!PyUnicode_CheckExact(name)) {
+        return -1;
+    }
+#else
+    if (!PyString_CheckExact(name)) {
+        return -1;
+    }
+#endif
+    if (!(code->co_flags & CO_OPTIMIZED)) {
+        return -1;
+    }
+
+    // f_localsplus layout: co_varnames, co_cellvars, co_freevars
+    names[0] = code->co_varnames;
+    names[1] = code->co_cellvars;
+    names[2] = code->co_freevars;
+    for (kind = 0; kind < 3; kind++) {
+        n = PyTuple_GET_SIZE(names[kind]);
+        for (i = 0; i < n; i++) {
+            if (_PyCompat_NameEqual(PyTuple_GET_ITEM(names[kind], i), name)) {
+                *value = fast[i];
+                if (kind != 0 && *value != NULL) {
+                    assert(PyCell_Check(*value));
+                    *value = PyCell_GET(*value);
+                }
+                found = 1;
+            }
+        }
+        fast += n;
+    }
+    return found;
+}
+#endif
+
+
 // gh-91248 added PyFrame_GetVar() to Python 3.12.0a2
 #if PY_VERSION_HEX < 0x030C00A2 && !defined(PYPY_VERSION)
 PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
 PyFrame_GetVar(PyFrameObject *frame, PyObject *name)
 {
     PyObject *locals, *value;
+#if (defined(PYTHONCAPI_COMPAT_FAST_LOCALS) && PY_VERSION_HEX < 0x030B0000 \
+     && !defined(PYPY_VERSION))
+    int found;
+#endif
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_FRAME_GETVAR);
+#if (defined(PYTHONCAPI_COMPAT_FAST_LOCALS) && PY_VERSION_HEX < 0x030B0000 \
+     && !defined(PYPY_VERSION))
+    found = _PyCompat_Frame_GetFastVar(frame, name, &value);
+    if (found >= 0) {
+        if (found == 0 && frame->f_locals != NULL) {
+            // Variable set in the frame locals dictionary
+#if PY_VERSION_HEX >= 0x03000000
+            value = PyDict_GetItemWithError(frame->f_locals, name);
+#else
+            value = _PyDict_GetItemWithError(frame->f_locals, name);
+#endif
+            if (value == NULL && PyErr_Occurred()) {
+                return NULL;
+            }
+        }
+        if (value == NULL) {
+            goto not_found;
+        }
+        return Py_NewRef(value);
+    }
+#endif
 
+    // Slow path: create or update the frame locals dictionary
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_FRAME_GETVAR);
     locals = PyFrame_GetLocals(frame);
     if (locals == NULL) {
         return NULL;
@@ -266,14 +645,17 @@ PyFrame_GetVar(PyFrameObject *frame, PyObject *name)
         if (PyErr_Occurred()) {
             return NULL;
         }
+        goto not_found;
+    }
+    return Py_NewRef(value);
+
+not_found:
 #if PY_VERSION_HEX >= 0x03000000
-        PyErr_Format(PyExc_NameError, "variable %R does not exist", name);
+    PyErr_Format(PyExc_NameError, "variable %R does not exist", name);
 #else
-        PyErr_SetString(PyExc_NameError, "variable does not exist");
+    PyErr_SetString(PyExc_NameError, "variable does not exist");
 #endif
-        return NULL;
-    }
-    return Py_NewRef(value);
+    return NULL;
 }
 #endif
 
@@ -284,11 +666,7 @@ PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
 PyFrame_GetVarString(PyFrameObject *frame, const char *name)
 {
     PyObject *name_obj, *value;
-#if PY_VERSION_HEX >= 0x03000000
-    name_obj = PyUnicode_FromString(name);
-#else
-    name_obj = PyString_FromString(name);
-#endif
+    name_obj = _PyCompat_FromString(name);
     if (name_obj == NULL) {
         return NULL;
     }
@@ -299,6 +677,46 @@ PyFrame_GetVarString(PyFrameObject *frame, const char *name)
 #endif
 
 
+// gh-101578 added PyErr_GetRaisedException() and PyErr_SetRaisedException()
+// to Python 3.12.0a6.
+//
+// On older Python versions, the exception is normalized once by
+// PyErr_GetRaisedException() and its traceback is attached to it, so the
+// exception is a single object. Not available on Python 2: exceptions have
+// no __traceback__ attribute.
+#if PY_VERSION_HEX >= 0x03000000 && PY_VERSION_HEX < 0x030C00A6
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyErr_GetRaisedException(void)
+{
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    if (type == NULL) {
+        return NULL;
+    }
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback != NULL) {
+        if (value != NULL && PyException_SetTraceback(value, traceback) < 0) {
+            PyErr_Clear();
+        }
+        Py_DECREF(traceback);
+    }
+    Py_DECREF(type);
+    return value;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+PyErr_SetRaisedException(PyObject *exc)
+{
+    PyObject *type = NULL, *traceback = NULL;
+    if (exc != NULL) {
+        type = Py_NewRef(_PyObject_CAST(Py_TYPE(exc)));
+        traceback = PyException_GetTraceback(exc);
+    }
+    PyErr_Restore(type, exc, traceback);
+}
+#endif
+
+
 // bpo-39947 added PyThreadState_GetInterpreter() to Python 3.9.0a5
 #if PY_VERSION_HEX < 0x030900A5 || defined(PYPY_VERSION)
 PYCAPI_COMPAT_STATIC_INLINE(PyInterpreterState *)
@@ -324,9 +742,78 @@ PyThreadState_GetFrame(PyThreadState *tstate)
 PYCAPI_COMPAT_STATIC_INLINE(PyFrameObject*)
 _PyThreadState_GetFrameBorrow(PyThreadState *tstate)
 {
+#if PY_VERSION_HEX < 0x030B0000
+    // Read the PyThreadState member: don't touch the reference count
+    assert(tstate != _Py_NULL);
+    return tstate->frame;
+#else
     PyFrameObject *frame = PyThreadState_GetFrame(tstate);
     Py_XDECREF(frame);
     return frame;
+#endif
+}
+#endif
+
+
+// Stack entry filled by PyCompat_CaptureStack()
+#if !defined(PYPY_VERSION)
+typedef struct {
+    PyCodeObject *code;   // borrowed reference
+    int lasti;            // PyFrame_GetLasti() result
+} PyCompat_StackEntry;
+
+// Fill entries with up to max_depth frames of tstate, from the innermost
+// frame to the outermost frame. Return the number of filled entries.
+//
+// Code objects are borrowed references: they are only valid while the frames
+// are executed.
+//
+// On Python 3.11 and newer, a frame object is created for each frame which
+// doesn't have one yet: the function can allocate memory.
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_CaptureStack(PyThreadState *tstate, PyCompat_StackEntry *entries,
+                      int max_depth)
+{
+    PyFrameObject *frame;
+    int depth = 0;
+
+    assert(tstate != _Py_NULL);
+#if PY_VERSION_HEX < 0x030B0000
+    // Walk the PyFrameObject structures: no function call and no reference
+    // count change
+    frame = tstate->frame;
+    while (frame != _Py_NULL && depth < max_depth) {
+        entries[depth].code = frame->f_code;
+        entries[depth].lasti = PyFrame_GetLasti(frame);
+        depth++;
+        frame = frame->f_back;
+    }
+#else
+    // Python 3.11 only gives access to frames through strong references.
+    // PyThreadState_GetFrame() and PyFrame_GetBack() create the frame object
+    // of a frame if needed; the frame object is then kept until the frame
+    // completes. Reference counts are unchanged when the function returns.
+    if (max_depth <= 0) {
+        return 0;
+    }
+    frame = PyThreadState_GetFrame(tstate);
+    while (frame != _Py_NULL) {
+        PyFrameObject *back;
+        // The executed frame holds a strong reference to its code object
+        entries[depth].code = _PyFrame_GetCodeBorrow(frame);
+        entries[depth].lasti = PyFrame_GetLasti(frame);
+        depth++;
+        if (depth < max_depth) {
+            back = PyFrame_GetBack(frame);
+        }
+        else {
+            back = _Py_NULL;
+        }
+        Py_DECREF(frame);
+        frame = back;
+    }
+#endif
+    return depth;
 }
 #endif
 
@@ -536,6 +1023,166 @@ PyFloat_Unpack8(const char *p, int le)
 #endif
 
 
+// PyCompat_Float_PackArray2(), PyCompat_Float_PackArray4(),
+// PyCompat_Float_PackArray8(), PyCompat_Float_UnpackArray2(),
+// PyCompat_Float_UnpackArray4() and PyCompat_Float_UnpackArray8() pack and
+// unpack n values. Results are the same as PyFloat_PackN() and
+// PyFloat_UnpackN() called on each value. Return 0 on success. On error, set
+// an exception and return -1.
+#if ((PY_VERSION_HEX <= 0x030B00A1 || 0x030B00A7 <= PY_VERSION_HEX) \
+     && !defined(PYPY_VERSION))
+// Return 1 if double uses the IEEE 754 binary64 format with little endian
+// byte order, 0 if it uses big endian, or -1 if the format is unknown.
+// Compilers usually compute the result at build time.
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Float_DoubleFormat(void)
+{
+    double x = 9006104071832581.0;
+    if (memcmp(&x, "\x43\x3f\xff\x01\x02\x03\x04\x05", 8) == 0) {
+        return 0;
+    }
+    if (memcmp(&x, "\x05\x04\x03\x02\x01\xff\x3f\x43", 8) == 0) {
+        return 1;
+    }
+    return -1;
+}
+
+// Copy n 8-byte items, reversing the bytes of each item if swap is non-zero
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_Float_Copy8(unsigned char *dst, const unsigned char *src,
+                      Py_ssize_t n, int swap)
+{
+    Py_ssize_t i;
+#if defined(__GNUC__) || defined(__clang__)
+    PY_UINT64_T u;
+#else
+    int j;
+#endif
+
+    if (n <= 0) {
+        // Do nothing, as the PyFloat_Pack8() loop
+        return;
+    }
+    if (!swap) {
+        memcpy(dst, src, _Py_CAST(size_t, n) * 8);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        memcpy(&u, src, 8);
+        u = __builtin_bswap64(u);
+        memcpy(dst, &u, 8);
+#else
+        for (j = 0; j < 8; j++) {
+            dst[j] = src[7 - j];
+        }
+#endif
+        dst += 8;
+        src += 8;
+    }
+}
+
+#if 0x030600B1 <= PY_VERSION_HEX
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_PackArray2(const double *data, char *p, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    for (i = 0; i < n; i++) {
+        if (PyFloat_Pack2(data[i], p + i * 2, le) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_UnpackArray2(const char *p, double *data, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    for (i = 0; i < n; i++) {
+        data[i] = PyFloat_Unpack2(p + i * 2, le);
+        if (data[i] == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_PackArray4(const double *data, char *p, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    for (i = 0; i < n; i++) {
+        if (PyFloat_Pack4(data[i], p + i * 4, le) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_UnpackArray4(const char *p, double *data, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    for (i = 0; i < n; i++) {
+        data[i] = PyFloat_Unpack4(p + i * 4, le);
+        if (data[i] == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_PackArray8(const double *data, char *p, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    int format = _PyCompat_Float_DoubleFormat();
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_FLOAT_PACKARRAY8);
+    if (format >= 0) {
+        // IEEE 754 format: PyFloat_Pack8() copies bytes
+        _PyCompat_Float_Copy8(_Py_CAST(unsigned char*, p),
+                              _Py_CAST(const unsigned char*, data),
+                              n, format != (le != 0));
+        return 0;
+    }
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_FLOAT_PACKARRAY8);
+    for (i = 0; i < n; i++) {
+        if (PyFloat_Pack8(data[i], p + i * 8, le) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Float_UnpackArray8(const char *p, double *data, Py_ssize_t n, int le)
+{
+    Py_ssize_t i;
+    int format = _PyCompat_Float_DoubleFormat();
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_FLOAT_UNPACKARRAY8);
+    if (format >= 0) {
+        // IEEE 754 format: PyFloat_Unpack8() copies bytes
+        _PyCompat_Float_Copy8(_Py_CAST(unsigned char*, data),
+                              _Py_CAST(const unsigned char*, p),
+                              n, format != (le != 0));
+        return 0;
+    }
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_FLOAT_UNPACKARRAY8);
+    for (i = 0; i < n; i++) {
+        data[i] = PyFloat_Unpack8(p + i * 8, le);
+        if (data[i] == -1.0 && PyErr_Occurred()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+
 // gh-92154 added PyCode_GetCode() to Python 3.11.0b1
 #if PY_VERSION_HEX < 0x030B00B1 && !defined(PYPY_VERSION)
 PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
@@ -574,14 +1221,524 @@ PyCode_GetCellvars(PyCodeObject *code)
 #endif
 
 
-// Py_UNUSED() was added to Python 3.4.0b2.
-#if PY_VERSION_HEX < 0x030400B2 && !defined(Py_UNUSED)
-#  if defined(__GNUC__) || defined(__clang__)
-#    define Py_UNUSED(name) _unused_ ## name __attribute__((unused))
-#  else
-#    define Py_UNUSED(name) _unused_ ## name
-#  endif
-#endif
+// gh-101101 added PyUnstable_Code_GetExtra(), PyUnstable_Code_SetExtra() and
+// PyUnstable_Eval_RequestCodeExtraIndex() to Python 3.12.0a6.
+// PEP 523 added _PyCode_GetExtra(), _PyCode_SetExtra() and
+// _PyEval_RequestCodeExtraIndex() to Python 3.6.0b1.
+#if (0x030600B1 <= PY_VERSION_HEX && PY_VERSION_HEX < 0x030C00A6 \
+     && !defined(PYPY_VERSION))
+PYCAPI_COMPAT_STATIC_INLINE(Py_ssize_t)
+PyUnstable_Eval_RequestCodeExtraIndex(freefunc func)
+{
+    return _PyEval_RequestCodeExtraIndex(func);
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyUnstable_Code_GetExtra(PyObject *code, Py_ssize_t index, void **extra)
+{
+    return _PyCode_GetExtra(code, index, extra);
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyUnstable_Code_SetExtra(PyObject *code, Py_ssize_t index, void *extra)
+{
+    return _PyCode_SetExtra(code, index, extra);
+}
+#endif
+
+
+#if !defined(PYPY_VERSION)
+// Line number of each code unit of a code object, created once per code
+// object by PyCompat_Code_Addr2Line().
+typedef struct {
+    Py_ssize_t size;   // number of code units
+    int lines[1];      // line number of each code unit, -1 if none
+} _PyCompat_LineTable;
+
+// bpo-26647: Python 3.6 uses 16-bit "wordcode" (2 bytes) instructions
+#if PY_VERSION_HEX >= 0x03060000
+#  define _PyCompat_CODE_UNIT 2
+#else
+#  define _PyCompat_CODE_UNIT 1
+#endif
+
+// Set the line number of code units in the [start; end) bytes range
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_LineTable_Fill(_PyCompat_LineTable *table,
+                         Py_ssize_t start, Py_ssize_t end, int line)
+{
+    Py_ssize_t i;
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > table->size * _PyCompat_CODE_UNIT) {
+        end = table->size * _PyCompat_CODE_UNIT;
+    }
+    for (i = start / _PyCompat_CODE_UNIT; i < end / _PyCompat_CODE_UNIT; i++) {
+        table->lines[i] = line;
+    }
+}
+
+// Decode the line table of a code object.
+// Return NULL with an exception set on error.
+PYCAPI_COMPAT_STATIC_INLINE(_PyCompat_LineTable*)
+_PyCompat_LineTable_New(PyCodeObject *code)
+{
+    _PyCompat_LineTable *table;
+    PyObject *bytecode;
+    Py_ssize_t size, i;
+#if PY_VERSION_HEX >= 0x030A0000
+    PyObject *lines, *iter, *item, *line_obj;
+    Py_ssize_t start, end;
+    long line;
+#else
+    const unsigned char *lnotab;
+    Py_ssize_t lnotab_size, addr = 0;
+    int line = code->co_firstlineno;
+#endif
+
+    bytecode = PyCode_GetCode(code);
+    if (bytecode == NULL) {
+        return NULL;
+    }
+    size = PyBytes_GET_SIZE(bytecode) / _PyCompat_CODE_UNIT;
+    Py_DECREF(bytecode);
+
+    table = _Py_CAST(_PyCompat_LineTable*,
+                     PyMem_Malloc(sizeof(_PyCompat_LineTable)
+                                  + _Py_CAST(size_t, size) * sizeof(int)));
+    if (table == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    table->size = size;
+    for (i = 0; i < size; i++) {
+        table->lines[i] = -1;
+    }
+
+#if PY_VERSION_HEX >= 0x030A0000
+    // bpo-43933: Python 3.10 added code.co_lines()
+    lines = PyObject_CallMethod(_PyObject_CAST(code), "co_lines", _Py_NULL);
+    if (lines == NULL) {
+        goto error;
+    }
+    iter = PyObject_GetIter(lines);
+    Py_DECREF(lines);
+    if (iter == NULL) {
+        goto error;
+    }
+    while ((item = PyIter_Next(iter)) != NULL) {
+        if (!PyArg_ParseTuple(item, "nnO", &start, &end, &line_obj)) {
+            Py_DECREF(item);
+            Py_DECREF(iter);
+            goto error;
+        }
+        if (line_obj != Py_None) {
+            line = PyLong_AsLong(line_obj);
+            if (line == -1 && PyErr_Occurred()) {
+                Py_DECREF(item);
+                Py_DECREF(iter);
+                goto error;
+            }
+            _PyCompat_LineTable_Fill(table, start, end, _Py_CAST(int, line));
+        }
+        Py_DECREF(item);
+    }
+    Py_DECREF(iter);
+    if (PyErr_Occurred()) {
+        goto error;
+    }
+#else
+    // Decode co_lnotab: see Objects/lnotab_notes.txt
+    lnotab = _Py_CAST(const unsigned char*, PyBytes_AS_STRING(code->co_lnotab));
+    lnotab_size = PyBytes_GET_SIZE(code->co_lnotab);
+    for (i = 0; i + 1 < lnotab_size; i += 2) {
+        _PyCompat_LineTable_Fill(table, addr, addr + lnotab[i], line);
+        addr += lnotab[i];
+#if PY_VERSION_HEX >= 0x03060000
+        // bpo-26107: Python 3.6 uses signed line number increments
+        line += _Py_CAST(signed char, lnotab[i + 1]);
+#else
+        line += lnotab[i + 1];
+#endif
+    }
+    _PyCompat_LineTable_Fill(table, addr, size * _PyCompat_CODE_UNIT, line);
+#endif
+    return table;
+
+#if PY_VERSION_HEX >= 0x030A0000
+error:
+    PyMem_Free(table);
+    return NULL;
+#endif
+}
+
+#if PY_VERSION_HEX < 0x030600B1
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_LineTable_CapsuleDestructor(PyObject *capsule)
+{
+    PyMem_Free(PyCapsule_GetPointer(capsule, _Py_NULL));
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(_PyCompat_LineTable*)
+_PyCompat_LineTable_FromTuple(PyObject *value)
+{
+    PyObject *capsule = PyTuple_GET_ITEM(value, 1);
+    return _Py_CAST(_PyCompat_LineTable*,
+                    PyCapsule_GetPointer(capsule, _Py_NULL));
+}
+
+// Weak reference callback: remove the line table of a destroyed code object.
+// self is a (tables, key) tuple.
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+_PyCompat_LineTable_Remove(PyObject *self, PyObject *ref)
+{
+    (void)ref;
+    if (PyDict_DelItem(PyTuple_GET_ITEM(self, 0),
+                       PyTuple_GET_ITEM(self, 1)) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// Store a line table in tables: id(code) => (weakref, capsule).
+// Return the (weakref, capsule) tuple as a borrowed reference.
+// Return NULL with an exception set on error.
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+_PyCompat_LineTable_Store(PyObject *tables, PyObject *key, PyCodeObject *code,
+                          _PyCompat_LineTable *table)
+{
+    static PyMethodDef remove_def = {
+        "_remove_line_table", _PyCompat_LineTable_Remove, METH_O, _Py_NULL
+    };
+    PyObject *capsule, *self, *callback, *ref, *value;
+    int res;
+
+    capsule = PyCapsule_New(table, _Py_NULL,
+                            _PyCompat_LineTable_CapsuleDestructor);
+    if (capsule == NULL) {
+        PyMem_Free(table);
+        return NULL;
+    }
+    self = PyTuple_Pack(2, tables, key);
+    if (self == NULL) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    callback = PyCFunction_New(&remove_def, self);
+    Py_DECREF(self);
+    if (callback == NULL) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    ref = PyWeakref_NewRef(_PyObject_CAST(code), callback);
+    Py_DECREF(callback);
+    if (ref == NULL) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    value = PyTuple_Pack(2, ref, capsule);
+    Py_DECREF(ref);
+    Py_DECREF(capsule);
+    if (value == NULL) {
+        return NULL;
+    }
+    res = PyDict_SetItem(tables, key, value);
+    Py_DECREF(value);
+    if (res < 0) {
+        return NULL;
+    }
+    return value;
+}
+#endif
+
+// Get the line table of a code object: create it at the first call.
+// Return NULL if the line table cannot be cached. Don't raise exceptions.
+PYCAPI_COMPAT_STATIC_INLINE(_PyCompat_LineTable*)
+_PyCompat_Code_GetLineTable(PyCodeObject *code)
+{
+    // Only the first interpreter calling the function uses the cache
+    static PyInterpreterState *cache_interp = _Py_NULL;
+#if PY_VERSION_HEX >= 0x030600B1
+    // The line table is stored in the co_extra of the code object
+    static Py_ssize_t index = -1;
+    void *extra;
+#else
+    // Weak mapping: id(code) => (weakref, capsule)
+    static PyObject *tables = _Py_NULL;
+    // (weakref, capsule) of the last code object
+    static PyObject *last = _Py_NULL;
+    PyObject *key, *value;
+#endif
+    _PyCompat_LineTable *table;
+#if PY_VERSION_HEX >= 0x030C00A6
+    PyObject *exc;
+#else
+    PyObject *exc_type, *exc_value, *exc_tb;
+#endif
+    PyInterpreterState *interp = PyInterpreterState_Get();
+
+    if (cache_interp == _Py_NULL) {
+        cache_interp = interp;
+#if PY_VERSION_HEX >= 0x030600B1
+        index = PyUnstable_Eval_RequestCodeExtraIndex(PyMem_Free);
+#else
+        tables = PyDict_New();
+        if (tables == NULL) {
+            PyErr_Clear();
+        }
+#endif
+    }
+    if (interp != cache_interp) {
+        return NULL;
+    }
+
+#if PY_VERSION_HEX >= 0x030600B1
+    if (index < 0) {
+        return NULL;
+    }
+    if (PyUnstable_Code_GetExtra(_PyObject_CAST(code), index, &extra) < 0) {
+        PyErr_Clear();
+        return NULL;
+    }
+    if (extra != NULL) {
+        return _Py_CAST(_PyCompat_LineTable*, extra);
+    }
+#else
+    if (tables == NULL) {
+        return NULL;
+    }
+    // The weak reference is dead if the code object was destroyed
+    if (last != NULL) {
+        PyObject *ref = PyTuple_GET_ITEM(last, 0);
+        if (PyWeakref_GET_OBJECT(ref) == _PyObject_CAST(code)) {
+            return _PyCompat_LineTable_FromTuple(last);
+        }
+    }
+    key = PyLong_FromVoidPtr(code);
+    if (key == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+    value = PyDict_GetItem(tables, key);
+    if (value != NULL) {
+        Py_DECREF(key);
+        Py_XSETREF(last, Py_NewRef(value));
+        return _PyCompat_LineTable_FromTuple(value);
+    }
+#endif
+
+    // Slow path: create the line table
+#if PY_VERSION_HEX >= 0x030C00A6
+    exc = PyErr_GetRaisedException();
+#else
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+#endif
+    table = _PyCompat_LineTable_New(code);
+    if (table != NULL) {
+#if PY_VERSION_HEX >= 0x030600B1
+        if (PyUnstable_Code_SetExtra(_PyObject_CAST(code), index, table) < 0) {
+            PyMem_Free(table);
+            table = NULL;
+        }
+#else
+        value = _PyCompat_LineTable_Store(tables, key, code, table);
+        if (value != NULL) {
+            Py_XSETREF(last, Py_NewRef(value));
+        }
+        else {
+            table = NULL;
+        }
+#endif
+    }
+    if (table == NULL) {
+        PyErr_Clear();
+    }
+#if PY_VERSION_HEX >= 0x030C00A6
+    PyErr_SetRaisedException(exc);
+#else
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+#endif
+#if PY_VERSION_HEX < 0x030600B1
+    Py_DECREF(key);
+#endif
+    return table;
+}
+
+// Similar to PyCode_Addr2Line(), but decode the line table once per code
+// object and keep the result in a cache. Return -1 if addrq is out of the
+// bytecode.
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyCompat_Code_Addr2Line(PyCodeObject *code, int addrq)
+{
+    _PyCompat_LineTable *table;
+    Py_ssize_t index;
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_CODE_ADDR2LINE);
+    if (addrq < 0) {
+        return code->co_firstlineno;
+    }
+#ifdef Py_GIL_DISABLED
+    // The line table cache is not thread-safe
+    table = NULL;
+#else
+    table = _PyCompat_Code_GetLineTable(code);
+#endif
+    if (table == NULL) {
+        _PyCompat_STAT_SLOW(_PyCompat_STAT_CODE_ADDR2LINE);
+        return PyCode_Addr2Line(code, addrq);
+    }
+    index = addrq / _PyCompat_CODE_UNIT;
+    if (index >= table->size) {
+        return -1;
+    }
+    return table->lines[index];
+}
+#endif
+
+
+// PyCompat_Code_GetCode(), PyCompat_Code_GetVarnames(),
+// PyCompat_Code_GetCellvars() and PyCompat_Code_GetFreevars() are similar to
+// PyCode_GetCode(), PyCode_GetVarnames(), PyCode_GetCellvars() and
+// PyCode_GetFreevars(), but cache the result in the code object.
+//
+// - Python 3.10 and older: return code object members.
+// - Python 3.11 caches co_code, but creates a new tuple of variable names at
+//   each call: store tuples in the code object extra data.
+// - Python 3.12 and newer cache all of them.
+#if !defined(PYPY_VERSION)
+#if 0x030B0000 <= PY_VERSION_HEX && PY_VERSION_HEX < 0x030C0000
+// Tuples of names indexed by _PyCompat_CODE_VARNAMES, _PyCompat_CODE_CELLVARS
+// and _PyCompat_CODE_FREEVARS
+typedef struct {
+    PyObject *names[3];
+} _PyCompat_CodeNames;
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_CodeNames_Free(void *ptr)
+{
+    _PyCompat_CodeNames *cache = _Py_CAST(_PyCompat_CodeNames*, ptr);
+    // Python 3.11 calls the function with NULL if the code object has no
+    // cache but has extra data of another index
+    if (cache == NULL) {
+        return;
+    }
+    Py_XDECREF(cache->names[0]);
+    Py_XDECREF(cache->names[1]);
+    Py_XDECREF(cache->names[2]);
+    PyMem_Free(cache);
+}
+#endif
+
+#define _PyCompat_CODE_VARNAMES 0
+#define _PyCompat_CODE_CELLVARS 1
+#define _PyCompat_CODE_FREEVARS 2
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+_PyCompat_Code_GetNames(PyCodeObject *code, int kind)
+{
+#if 0x030B0000 <= PY_VERSION_HEX && PY_VERSION_HEX < 0x030C0000
+    // Only the first interpreter calling the function uses the cache
+    static PyInterpreterState *cache_interp = _Py_NULL;
+    static Py_ssize_t index = -1;
+    PyInterpreterState *interp = PyInterpreterState_Get();
+    _PyCompat_CodeNames *cache;
+    void *extra;
+#endif
+
+    _PyCompat_STAT_CALL(_PyCompat_STAT_CODE_GETNAMES);
+#if 0x030B0000 <= PY_VERSION_HEX && PY_VERSION_HEX < 0x030C0000
+    if (cache_interp == _Py_NULL) {
+        cache_interp = interp;
+        index = PyUnstable_Eval_RequestCodeExtraIndex(
+                    _PyCompat_CodeNames_Free);
+    }
+    if (interp == cache_interp && index >= 0) {
+        if (PyUnstable_Code_GetExtra(_PyObject_CAST(code), index, &extra) < 0) {
+            return NULL;
+        }
+        cache = _Py_CAST(_PyCompat_CodeNames*, extra);
+        if (cache == NULL) {
+            cache = _Py_CAST(_PyCompat_CodeNames*,
+                             PyMem_Calloc(1, sizeof(_PyCompat_CodeNames)));
+            if (cache == NULL) {
+                PyErr_NoMemory();
+                return NULL;
+            }
+            if (PyUnstable_Code_SetExtra(_PyObject_CAST(code), index,
+                                         cache) < 0) {
+                PyMem_Free(cache);
+                return NULL;
+            }
+        }
+        if (cache->names[kind] == NULL) {
+            PyObject *names;
+            _PyCompat_STAT_SLOW(_PyCompat_STAT_CODE_GETNAMES);
+            if (kind == _PyCompat_CODE_VARNAMES) {
+                names = PyCode_GetVarnames(code);
+            }
+            else if (kind == _PyCompat_CODE_CELLVARS) {
+                names = PyCode_GetCellvars(code);
+            }
+            else {
+                names = PyCode_GetFreevars(code);
+            }
+            if (names == NULL) {
+                return NULL;
+            }
+            cache->names[kind] = names;
+        }
+        return Py_NewRef(cache->names[kind]);
+    }
+    // Python 3.11 creates a new tuple
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_CODE_GETNAMES);
+#endif
+
+    if (kind == _PyCompat_CODE_VARNAMES) {
+        return PyCode_GetVarnames(code);
+    }
+    else if (kind == _PyCompat_CODE_CELLVARS) {
+        return PyCode_GetCellvars(code);
+    }
+    else {
+        return PyCode_GetFreevars(code);
+    }
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyCompat_Code_GetCode(PyCodeObject *code)
+{
+    return PyCode_GetCode(code);
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyCompat_Code_GetVarnames(PyCodeObject *code)
+{
+    return _PyCompat_Code_GetNames(code, _PyCompat_CODE_VARNAMES);
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyCompat_Code_GetCellvars(PyCodeObject *code)
+{
+    return _PyCompat_Code_GetNames(code, _PyCompat_CODE_CELLVARS);
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyCompat_Code_GetFreevars(PyCodeObject *code)
+{
+    return _PyCompat_Code_GetNames(code, _PyCompat_CODE_FREEVARS);
+}
+#endif
+
+
+// Py_UNUSED() was added to Python 3.4.0b2.
+#if PY_VERSION_HEX < 0x030400B2 && !defined(Py_UNUSED)
+#  if defined(__GNUC__) || defined(__clang__)
+#    define Py_UNUSED(name) _unused_ ## name __attribute__((unused))
+#  else
+#    define Py_UNUSED(name) _unused_ ## name
+#  endif
+#endif
 
 
 // gh-105922 added PyImport_AddModuleRef() to Python 3.13.0a1
@@ -644,12 +1801,31 @@ PyObject_Vectorcall(PyObject *callable, PyObject *const *args,
 {
 #if PY_VERSION_HEX >= 0x030800B1 && !defined(PYPY_VERSION)
     // bpo-36974 added _PyObject_Vectorcall() to Python 3.8.0b1
+    _PyCompat_STAT_CALL(_PyCompat_STAT_VECTORCALL);
     return _PyObject_Vectorcall(callable, args, nargsf, kwnames);
+#elif PY_VERSION_HEX >= 0x030600B1 && !defined(PYPY_VERSION)
+    // bpo-27830 added _PyObject_FastCallKeywords() to Python 3.6.0b1.
+    // Unlike PyObject_Call(), it doesn't have to pack positional arguments
+    // into a new tuple and keyword arguments into a new dict.
+    _PyCompat_STAT_CALL(_PyCompat_STAT_VECTORCALL);
+    if (nargsf != 0 && args == NULL) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
+    if (kwnames != NULL && !PyTuple_Check(kwnames)) {
+        PyErr_BadInternalCall();
+        return NULL;
+    }
+    return _PyObject_FastCallKeywords(callable, _Py_CAST(PyObject**, args),
+                                      PyVectorcall_NARGS(nargsf), kwnames);
 #else
     PyObject *posargs = NULL, *kwargs = NULL;
     PyObject *res;
     Py_ssize_t nposargs, nkwargs, i;
 
+    // Slow path: create a tuple and a dict
+    _PyCompat_STAT_CALL(_PyCompat_STAT_VECTORCALL);
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_VECTORCALL);
     if (nargsf != 0 && args == NULL) {
         PyErr_BadInternalCall();
         goto error;
@@ -703,7 +1879,7 @@ PyObject_Vectorcall(PyObject *callable, PyObject *const *args,
     return res;
 
 error:
-    Py_DECREF(posargs);
+    Py_XDECREF(posargs);
     Py_XDECREF(kwargs);
     return NULL;
 #endif
@@ -711,6 +1887,82 @@ error:
 #endif
 
 
+// Similar to _PyObject_GenericGetAttrWithDict(obj, name, NULL, 1) of
+// Python 3.7: PyObject_GenericGetAttr() which doesn't raise AttributeError if
+// the attribute doesn't exist. The type must be ready and name must be
+// a string.
+#if PY_VERSION_HEX < 0x030700B1 && !defined(PYPY_VERSION)
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_GenericGetOptionalAttr(PyObject *obj, PyObject *name,
+                                 PyObject **result)
+{
+    PyTypeObject *type = Py_TYPE(obj);
+    PyObject *descr, *dict, *res;
+    PyObject **dictptr;
+    descrgetfunc get = NULL;
+
+    descr = _PyType_Lookup(type, name);
+    if (descr != NULL) {
+        Py_INCREF(descr);
+#if PY_VERSION_HEX < 0x03000000
+        if (PyType_HasFeature(Py_TYPE(descr), Py_TPFLAGS_HAVE_CLASS))
+#endif
+        {
+            get = Py_TYPE(descr)->tp_descr_get;
+        }
+        if (get != NULL && Py_TYPE(descr)->tp_descr_set != NULL) {
+            // data descriptor
+            res = get(descr, obj, _PyObject_CAST(type));
+            Py_DECREF(descr);
+            goto done;
+        }
+    }
+
+    dictptr = _PyObject_GetDictPtr(obj);
+    if (dictptr != NULL && *dictptr != NULL) {
+        dict = Py_NewRef(*dictptr);
+#if PY_VERSION_HEX >= 0x03000000
+        res = PyDict_GetItemWithError(dict, name);
+#else
+        res = _PyDict_GetItemWithError(dict, name);
+#endif
+        if (res != NULL) {
+            *result = Py_NewRef(res);
+            Py_DECREF(dict);
+            Py_XDECREF(descr);
+            return 1;
+        }
+        Py_DECREF(dict);
+        if (PyErr_Occurred()) {
+            *result = NULL;
+            Py_XDECREF(descr);
+            return -1;
+        }
+    }
+
+    if (get != NULL) {
+        res = get(descr, obj, _PyObject_CAST(type));
+        Py_DECREF(descr);
+        goto done;
+    }
+    // descr is NULL or a strong reference to a class attribute
+    *result = descr;
+    return (descr != NULL);
+
+done:
+    *result = res;
+    if (res != NULL) {
+        return 1;
+    }
+    if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+        PyErr_Clear();
+        return 0;
+    }
+    return -1;
+}
+#endif
+
+
 // gh-106521 added PyObject_GetOptionalAttr() to Python 3.13.0a1
 #if PY_VERSION_HEX < 0x030D00A1
 PYCAPI_COMPAT_STATIC_INLINE(int)
@@ -718,8 +1970,30 @@ PyObject_GetOptionalAttr(PyObject *obj, PyObject *name, PyObject **result)
 {
     // bpo-32571 added _PyObject_LookupAttr() to Python 3.7.0b1
 #if PY_VERSION_HEX >= 0x030700B1 && !defined(PYPY_VERSION)
+    _PyCompat_STAT_CALL(_PyCompat_STAT_GETOPTIONALATTR);
     return _PyObject_LookupAttr(obj, name, result);
 #else
+#if !defined(PYPY_VERSION)
+    // Avoid creating an AttributeError exception if the type uses the
+    // generic implementation to get attributes
+    PyTypeObject *type = Py_TYPE(obj);
+#if PY_VERSION_HEX >= 0x03000000
+    int exact_str = PyUnicode_CheckExact(name);
+#else
+    int exact_str = PyString_CheckExact(name);
+#endif
+    _PyCompat_STAT_CALL(_PyCompat_STAT_GETOPTIONALATTR);
+    if (type->tp_getattro == PyObject_GenericGetAttr
+        && type->tp_dict != NULL && exact_str)
+    {
+        return _PyCompat_GenericGetOptionalAttr(obj, name, result);
+    }
+#else
+    _PyCompat_STAT_CALL(_PyCompat_STAT_GETOPTIONALATTR);
+#endif
+
+    // Slow path: an AttributeError exception can be created
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_GETOPTIONALATTR);
     *result = PyObject_GetAttr(obj, name);
     if (*result != NULL) {
         return 1;
@@ -740,11 +2014,7 @@ PyObject_GetOptionalAttrString(PyObject *obj, const char *name, PyObject **resul
 {
     PyObject *name_obj;
     int rc;
-#if PY_VERSION_HEX >= 0x03000000
-    name_obj = PyUnicode_FromString(name);
-#else
-    name_obj = PyString_FromString(name);
-#endif
+    name_obj = _PyCompat_FromString(name);
     if (name_obj == NULL) {
         return -1;
     }
@@ -755,11 +2025,100 @@ PyObject_GetOptionalAttrString(PyObject *obj, const char *name, PyObject **resul
 #endif
 
 
+// gh-108511 added PyObject_HasAttrWithError() and
+// PyObject_HasAttrStringWithError() to Python 3.13.0a1.
+//
+// Use PyObject_GetOptionalAttr() which doesn't create an AttributeError
+// exception for types using the generic implementation to get attributes.
+#if PY_VERSION_HEX < 0x030D00A1
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyObject_HasAttrWithError(PyObject *obj, PyObject *attr)
+{
+    PyObject *res = NULL;
+    int rc = PyObject_GetOptionalAttr(obj, attr, &res);
+    Py_XDECREF(res);
+    return rc;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyObject_HasAttrStringWithError(PyObject *obj, const char *attr)
+{
+    PyObject *res = NULL;
+    int rc = PyObject_GetOptionalAttrString(obj, attr, &res);
+    Py_XDECREF(res);
+    return rc;
+}
+#endif
+
+
+// Check if obj[key] behaves as dict.__getitem__() without __missing__():
+// obj is a dict, or a dict subclass which doesn't override __getitem__() and
+// doesn't define __missing__().
+#if PY_VERSION_HEX < 0x030D00A1
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Dict_HasExactGetItem(PyObject *obj)
+{
+#if !defined(PYPY_VERSION)
+    static PyObject *missing_str = NULL;
+    PyTypeObject *type;
+#endif
+
+    if (PyDict_CheckExact(obj)) {
+        return 1;
+    }
+#if !defined(PYPY_VERSION)
+    if (!PyDict_Check(obj)) {
+        return 0;
+    }
+    type = Py_TYPE(obj);
+    if (type->tp_as_mapping == NULL
+        || type->tp_as_mapping->mp_subscript != PyDict_Type.tp_as_mapping->mp_subscript)
+    {
+        return 0;
+    }
+    if (missing_str == NULL) {
+        // Before Python 3.13, interned strings are shared by all interpreters
+#if PY_VERSION_HEX >= 0x03000000
+        missing_str = PyUnicode_InternFromString("__missing__");
+#else
+        missing_str = PyString_InternFromString("__missing__");
+#endif
+        if (missing_str == NULL) {
+            PyErr_Clear();
+            return 0;
+        }
+    }
+    return (_PyType_Lookup(type, missing_str) == NULL);
+#else
+    return 0;
+#endif
+}
+#endif
+
+
 // gh-106307 added PyObject_GetOptionalAttr() to Python 3.13.0a1
 #if PY_VERSION_HEX < 0x030D00A1
 PYCAPI_COMPAT_STATIC_INLINE(int)
 PyMapping_GetOptionalItem(PyObject *obj, PyObject *key, PyObject **result)
 {
+    _PyCompat_STAT_CALL(_PyCompat_STAT_GETOPTIONALITEM);
+    if (_PyCompat_Dict_HasExactGetItem(obj)) {
+        // Don't create a KeyError exception if the key is missing
+#if PY_VERSION_HEX >= 0x03000000
+        PyObject *item = PyDict_GetItemWithError(obj, key);
+#else
+        PyObject *item = _PyDict_GetItemWithError(obj, key);
+#endif
+        if (item != NULL) {
+            *result = Py_NewRef(item);
+            return 1;
+        }
+        *result = NULL;
+        return (PyErr_Occurred() ? -1 : 0);
+    }
+
+    // Slow path: a KeyError exception can be created
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_GETOPTIONALITEM);
     *result = PyObject_GetItem(obj, key);
     if (*result) {
         return 1;
@@ -776,11 +2135,7 @@ PyMapping_GetOptionalItemString(PyObject *obj, const char *key, PyObject **resul
 {
     PyObject *key_obj;
     int rc;
-#if PY_VERSION_HEX >= 0x03000000
-    key_obj = PyUnicode_FromString(key);
-#else
-    key_obj = PyString_FromString(key);
-#endif
+    key_obj = _PyCompat_FromString(key);
     if (key_obj == NULL) {
         return -1;
     }
@@ -818,11 +2173,7 @@ PYCAPI_COMPAT_STATIC_INLINE(int)
 PyDict_GetItemStringRef(PyObject *mp, const char *key, PyObject **result)
 {
     int res;
-#if PY_VERSION_HEX >= 0x03000000
-    PyObject *key_obj = PyUnicode_FromString(key);
-#else
-    PyObject *key_obj = PyString_FromString(key);
-#endif
+    PyObject *key_obj = _PyCompat_FromString(key);
     if (key_obj == NULL) {
         *result = NULL;
         return -1;
@@ -846,6 +2197,388 @@ PyModule_Add(PyObject *mod, const char *name, PyObject *value)
 #endif
 
 
+// gh-111262 added PyDict_Pop() and PyDict_PopString() to Python 3.13.0a2
+#if PY_VERSION_HEX < 0x030D00A2
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyDict_Pop(PyObject *dict, PyObject *key, PyObject **result)
+{
+    PyObject *value;
+
+    if (!PyDict_Check(dict)) {
+        PyErr_BadInternalCall();
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+
+    // bpo-16991 added _PyDict_Pop() to Python 3.5.0b2: a single lookup.
+    // Python 3.6.0b3 changed its first argument type to PyObject*. Python
+    // 3.13.0a1 removed it.
+#if (PY_VERSION_HEX >= 0x030500B2 && PY_VERSION_HEX < 0x030D0000 \
+     && !defined(PYPY_VERSION))
+    {
+        // Pass a private sentinel object as the default value, rather than
+        // NULL, to not create a KeyError if the key is missing. It cannot be
+        // stored in a dict, so getting it back means that the key is missing.
+        static struct { PyObject ob_base; } missing = {
+            PyObject_HEAD_INIT(_Py_NULL)
+        };
+        PyObject *sentinel = &missing.ob_base;
+#if PY_VERSION_HEX >= 0x030600B3
+        value = _PyDict_Pop(dict, key, sentinel);
+#else
+        value = _PyDict_Pop(_Py_CAST(PyDictObject*, dict), key, sentinel);
+#endif
+        if (value == NULL) {
+            if (result) {
+                *result = NULL;
+            }
+            return -1;
+        }
+        if (value == sentinel) {
+            Py_DECREF(value);
+            if (result) {
+                *result = NULL;
+            }
+            return 0;
+        }
+    }
+#else
+    {
+        int res = PyDict_GetItemRef(dict, key, &value);
+        if (res <= 0) {
+            if (result) {
+                *result = NULL;
+            }
+            return res;
+        }
+        if (PyDict_DelItem(dict, key) < 0) {
+            Py_DECREF(value);
+            if (result) {
+                *result = NULL;
+            }
+            return -1;
+        }
+    }
+#endif
+
+    if (result) {
+        *result = value;
+    }
+    else {
+        Py_DECREF(value);
+    }
+    return 1;
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyDict_PopString(PyObject *dict, const char *key, PyObject **result)
+{
+    int res;
+    PyObject *key_obj = _PyCompat_FromString(key);
+    if (key_obj == NULL) {
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+    res = PyDict_Pop(dict, key_obj, result);
+    Py_DECREF(key_obj);
+    return res;
+}
+#endif
+
+
+// gh-112066 added PyDict_SetDefaultRef() to Python 3.13.0a4
+#if PY_VERSION_HEX < 0x030D00A4
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyDict_SetDefaultRef(PyObject *d, PyObject *key, PyObject *default_value,
+                     PyObject **result)
+{
+    PyObject *value;
+
+    // Python 3.4 added PyDict_SetDefault(): a single lookup which returns
+    // a borrowed reference. If it is not the default value, the key was
+    // present.
+#if PY_VERSION_HEX >= 0x03040000 && !defined(PYPY_VERSION)
+    Py_ssize_t size;
+
+    if (!PyDict_Check(d)) {
+        PyErr_BadInternalCall();
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+    size = _Py_CAST(PyDictObject*, d)->ma_used;
+    value = PyDict_SetDefault(d, key, default_value);
+    if (value == NULL) {
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+    if (result) {
+        *result = Py_NewRef(value);
+    }
+    if (value != default_value) {
+        return 1;
+    }
+    // The default value was inserted, or it was already the value of the
+    // key: the dict size tells. A key __eq__() method mutating the dict can
+    // only make it wrong if the default value was already the value.
+    return (_Py_CAST(PyDictObject*, d)->ma_used != size ? 0 : 1);
+#else
+    if (PyDict_GetItemRef(d, key, &value) < 0) {
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+    if (value != NULL) {
+        // present
+        if (result) {
+            *result = value;
+        }
+        else {
+            Py_DECREF(value);
+        }
+        return 1;
+    }
+
+    // missing: set the item
+    if (PyDict_SetItem(d, key, default_value) < 0) {
+        if (result) {
+            *result = NULL;
+        }
+        return -1;
+    }
+    if (result) {
+        *result = Py_NewRef(default_value);
+    }
+    return 0;
+#endif
+}
+#endif
+
+
+// gh-114329 added PyList_GetItemRef() to Python 3.13.0a4
+#if PY_VERSION_HEX < 0x030D00A4
+PYCAPI_COMPAT_STATIC_INLINE(PyObject*)
+PyList_GetItemRef(PyObject *op, Py_ssize_t index)
+{
+    PyObject *item = PyList_GetItem(op, index);
+    Py_XINCREF(item);
+    return item;
+}
+#endif
+
+
+// gh-117511 added PyMutex, PyMutex_Lock() and PyMutex_Unlock() to Python
+// 3.13.0b3.
+//
+// On older Python versions, PyMutex is a 32-bit integer which must be
+// initialized to zero. The fast path is a single atomic operation. On
+// contention, spin a few times by yielding the CPU, and then park the thread:
+// wait on a futex on Linux, yield the CPU in a loop on other platforms. As on
+// Python 3.13, PyMutex_Lock() releases the GIL while the thread is parked.
+//
+// Only available if the compiler supports atomic operations: GCC, clang and
+// MSVC.
+#if (PY_VERSION_HEX < 0x030D00B3 \
+     && (defined(__ATOMIC_ACQUIRE) || defined(_MSC_VER)))
+#ifdef _WIN32
+// Declare SwitchToThread() rather than including <windows.h> which defines
+// many macros such as min() and max().
+__declspec(dllimport) int __stdcall SwitchToThread(void);
+#endif
+
+typedef struct PyMutex {
+    // 0: unlocked, 1: locked, 2: locked and threads may be parked (Linux)
+    int _bits;
+} PyMutex;
+
+// Number of attempts to lock a mutex before parking the thread
+#define _PyCompat_MUTEX_SPIN 40
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Mutex_CAS(int *bits, int expected, int desired)
+{
+#ifdef _MSC_VER
+    return (_InterlockedCompareExchange(_Py_CAST(volatile long*, bits),
+                                        desired, expected) == expected);
+#else
+    return __atomic_compare_exchange_n(bits, &expected, desired, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Mutex_Exchange(int *bits, int value)
+{
+#ifdef _MSC_VER
+    return _Py_CAST(int, _InterlockedExchange(_Py_CAST(volatile long*, bits),
+                                              value));
+#else
+    return __atomic_exchange_n(bits, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(int)
+_PyCompat_Mutex_Load(int *bits)
+{
+#ifdef _MSC_VER
+    return *_Py_CAST(volatile int*, bits);
+#else
+    return __atomic_load_n(bits, __ATOMIC_RELAXED);
+#endif
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_Mutex_Yield(void)
+{
+#ifdef _WIN32
+    (void)SwitchToThread();
+#else
+    (void)sched_yield();
+#endif
+}
+
+// Get the thread state attached to the current thread, or NULL if the
+// current thread doesn't hold the GIL.
+//
+// Before Python 3.13, _PyThreadState_UncheckedGet() and _PyThreadState_Current
+// are the thread state of the thread holding the GIL, not the thread state of
+// the current thread: compare it to PyGILState_GetThisThreadState(). Don't
+// use PyGILState_Check(): it returns 1 if the GIL state API is disabled
+// (subinterpreters) or not initialized yet.
+PYCAPI_COMPAT_STATIC_INLINE(PyThreadState*)
+_PyCompat_ThreadState_GetUnchecked(void)
+{
+#if PY_VERSION_HEX >= 0x030D00A1
+    return PyThreadState_GetUnchecked();
+#elif !defined(PYPY_VERSION)
+    PyThreadState *tstate;
+#if PY_VERSION_HEX >= 0x03060000
+    tstate = _PyThreadState_UncheckedGet();
+#elif PY_VERSION_HEX >= 0x03030000
+    tstate = _Py_CAST(PyThreadState*,
+                      _Py_atomic_load_relaxed(&_PyThreadState_Current));
+#else
+    tstate = _PyThreadState_Current;
+#endif
+    if (tstate != _Py_NULL && tstate == PyGILState_GetThisThreadState()) {
+        return tstate;
+    }
+    return _Py_NULL;
+#elif PY_VERSION_HEX >= 0x03040000
+    return (PyGILState_Check() ? PyThreadState_Get() : _Py_NULL);
+#else
+    return _Py_NULL;
+#endif
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+_PyCompat_Mutex_LockSlow(PyMutex *m)
+{
+    PyThreadState *tstate = _Py_NULL;
+    int i;
+
+    _PyCompat_STAT_SLOW(_PyCompat_STAT_MUTEX_LOCK);
+    for (i = 0; i < _PyCompat_MUTEX_SPIN; i++) {
+        _PyCompat_Mutex_Yield();
+        if (_PyCompat_Mutex_Load(&m->_bits) == 0
+            && _PyCompat_Mutex_CAS(&m->_bits, 0, 1)) {
+            return;
+        }
+    }
+
+    // Release the GIL while the thread is parked: the thread holding the
+    // mutex may wait for the GIL. Only detach the thread state if it's
+    // attached to the current thread.
+    if (_PyCompat_ThreadState_GetUnchecked() != _Py_NULL) {
+        tstate = PyEval_SaveThread();
+    }
+#ifdef __linux__
+    // Set the mutex to 2 to ask PyMutex_Unlock() to wake up a parked thread
+    while (_PyCompat_Mutex_Exchange(&m->_bits, 2) != 0) {
+        (void)syscall(SYS_futex, &m->_bits, FUTEX_WAIT_PRIVATE, 2,
+                      _Py_NULL, _Py_NULL, 0);
+    }
+#else
+    while (!_PyCompat_Mutex_CAS(&m->_bits, 0, 1)) {
+        _PyCompat_Mutex_Yield();
+    }
+#endif
+    if (tstate != _Py_NULL) {
+        PyEval_RestoreThread(tstate);
+    }
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+PyMutex_Lock(PyMutex *m)
+{
+    _PyCompat_STAT_CALL(_PyCompat_STAT_MUTEX_LOCK);
+    if (!_PyCompat_Mutex_CAS(&m->_bits, 0, 1)) {
+        _PyCompat_Mutex_LockSlow(m);
+    }
+}
+
+PYCAPI_COMPAT_STATIC_INLINE(void)
+PyMutex_Unlock(PyMutex *m)
+{
+    int bits = _PyCompat_Mutex_Exchange(&m->_bits, 0);
+    if (bits == 0) {
+        Py_FatalError("unlocking mutex that is not locked");
+    }
+#ifdef __linux__
+    if (bits == 2) {
+        (void)syscall(SYS_futex, &m->_bits, FUTEX_WAKE_PRIVATE, 1,
+                      _Py_NULL, _Py_NULL, 0);
+    }
+#endif
+}
+#endif
+
+
+// gh-119344 added Py_BEGIN_CRITICAL_SECTION(), Py_END_CRITICAL_SECTION(),
+// Py_BEGIN_CRITICAL_SECTION2() and Py_END_CRITICAL_SECTION2() to Python
+// 3.13.0b2. Free-threaded builds were added to Python 3.13: on older
+// versions, the GIL protects objects and the macros only open and close
+// a block.
+#if PY_VERSION_HEX < 0x030D00B2 && !defined(Py_BEGIN_CRITICAL_SECTION)
+#  define Py_BEGIN_CRITICAL_SECTION(op) {
+#  define Py_END_CRITICAL_SECTION() }
+#  define Py_BEGIN_CRITICAL_SECTION2(a, b) {
+#  define Py_END_CRITICAL_SECTION2() }
+#endif
+
+
+// gh-116322 added the Py_mod_gil module slot, Py_MOD_GIL_USED and
+// Py_MOD_GIL_NOT_USED to Python 3.13.0a6.
+//
+// Py_mod_gil is not defined on older Python versions: they reject unknown
+// slots. Use "#ifdef Py_mod_gil" to declare the slot.
+#if PY_VERSION_HEX < 0x030D00A6 && !defined(Py_MOD_GIL_USED)
+#  define Py_MOD_GIL_USED _Py_CAST(void*, 0)
+#  define Py_MOD_GIL_NOT_USED _Py_CAST(void*, 1)
+#endif
+
+// gh-116322 added PyUnstable_Module_SetGIL() to Python 3.13.0a6, only to
+// free-threaded builds. Modules using single-phase initialization can call it
+// unconditionally: it does nothing if the GIL cannot be disabled.
+#ifndef Py_GIL_DISABLED
+PYCAPI_COMPAT_STATIC_INLINE(int)
+PyUnstable_Module_SetGIL(PyObject *module, void *gil)
+{
+    (void)module;
+    (void)gil;
+    return 0;
+}
+#endif
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,522 @@
+// C++ companion header of pythoncapi_compat.h: reference types and helper
+// functions.
+//
+// File distributed under the Zero Clause BSD (0BSD) license.
+// Copyright Contributors to the pythoncapi_compat project.
+//
+// Homepage:
+// https://github.com/python/pythoncapi_compat
+//
+// Latest version:
+// https://raw.githubusercontent.com/python/pythoncapi_compat/master/pythoncapi_compat.hpp
+//
+// SPDX-License-Identifier: 0BSD
+
+#ifndef PYTHONCAPI_COMPAT_HPP
+#define PYTHONCAPI_COMPAT_HPP
+
+#include "pythoncapi_compat.h"
+
+#if !defined(__cplusplus) || (__cplusplus < 201103 \
+     && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201103))
+#  error "pythoncapi_compat.hpp requires C++11 or newer"
+#endif
+
+#include <algorithm>              // std::copy(), std::equal()
+#include <array>
+#include <atomic>
+#include <cstddef>                // std::nullptr_t, std::size_t
+#include <cstdint>                // std::intptr_t
+#include <type_traits>            // std::integral_constant
+
+
+namespace pycompat {
+
+template <typename T> class Ref;
+
+
+// Borrowed reference: doesn't hold a reference, the object must be kept alive
+// by someone else. Copying a BorrowedRef is free.
+//
+// T is PyObject or a structure starting with PyObject_HEAD,
+// like PyCodeObject.
+template <typename T = PyObject>
+class BorrowedRef {
+public:
+    BorrowedRef() noexcept : obj_(nullptr) {}
+    BorrowedRef(std::nullptr_t) noexcept : obj_(nullptr) {}
+    BorrowedRef(T *obj) noexcept : obj_(obj) {}
+
+    T* get() const noexcept { return obj_; }
+    T* operator->() const noexcept { return obj_; }
+    explicit operator bool() const noexcept { return obj_ != nullptr; }
+
+    // Create a strong reference
+    Ref<T> new_ref() const noexcept;
+
+private:
+    T *obj_;
+};
+
+
+// Strong reference: Py_XDECREF() is called on the object when the reference
+// is destroyed.
+//
+// Ref is move-only: moving a Ref transfers the ownership without changing the
+// reference count. Implicit copies are not allowed, copy() must be called
+// explicitly to create a new strong reference.
+//
+// T is PyObject or a structure starting with PyObject_HEAD,
+// like PyCodeObject.
+template <typename T = PyObject>
+class Ref {
+public:
+    Ref() noexcept : obj_(nullptr) {}
+    Ref(std::nullptr_t) noexcept : obj_(nullptr) {}
+
+    // Adopt a strong reference, like the result of Py_NewRef() or
+    // PyFrame_GetCode(): the reference count is not changed.
+    static Ref steal(T *obj) noexcept { return Ref(obj); }
+
+    // Create a new strong reference: increment the reference count.
+    static Ref new_ref(T *obj) noexcept {
+        Py_XINCREF(to_object(obj));
+        return Ref(obj);
+    }
+
+    Ref(Ref &&other) noexcept : obj_(other.obj_) {
+        other.obj_ = nullptr;
+    }
+
+    Ref& operator=(Ref &&other) noexcept {
+        T *old = obj_;
+        obj_ = other.obj_;
+        other.obj_ = nullptr;
+        Py_XDECREF(to_object(old));
+        return *this;
+    }
+
+    Ref(const Ref &) = delete;
+    Ref& operator=(const Ref &) = delete;
+
+    ~Ref() {
+        Py_XDECREF(to_object(obj_));
+    }
+
+    T* get() const noexcept { return obj_; }
+    T* operator->() const noexcept { return obj_; }
+    explicit operator bool() const noexcept { return obj_ != nullptr; }
+    BorrowedRef<T> borrow() const noexcept { return BorrowedRef<T>(obj_); }
+
+    // Create a new strong reference to the same object
+    Ref copy() const noexcept { return new_ref(obj_); }
+
+    // Give the strong reference to the caller
+    T* release() noexcept {
+        T *obj = obj_;
+        obj_ = nullptr;
+        return obj;
+    }
+
+    // Replace the object with obj, adopt its strong reference
+    void reset(T *obj = nullptr) noexcept {
+        T *old = obj_;
+        obj_ = obj;
+        Py_XDECREF(to_object(old));
+    }
+
+private:
+    explicit Ref(T *obj) noexcept : obj_(obj) {}
+
+    static PyObject* to_object(T *obj) noexcept {
+        return reinterpret_cast<PyObject*>(obj);
+    }
+
+    T *obj_;
+};
+
+
+template <typename T>
+inline Ref<T> BorrowedRef<T>::new_ref() const noexcept
+{
+    return Ref<T>::new_ref(obj_);
+}
+
+
+namespace detail {
+
+inline PyObject* as_object(PyObject *obj) noexcept { return obj; }
+
+template <typename T>
+inline PyObject* as_object(const Ref<T> &ref) noexcept
+{
+    return reinterpret_cast<PyObject*>(ref.get());
+}
+
+template <typename T>
+inline PyObject* as_object(BorrowedRef<T> ref) noexcept
+{
+    return reinterpret_cast<PyObject*>(ref.get());
+}
+
+}  // namespace detail
+
+
+// Keyword argument of call(), created by kw()
+struct KwArg {
+    const char *name;
+    PyObject *value;
+};
+
+// Keyword argument of call(). name must be a string literal, or a string
+// which is not modified nor freed: the keyword names are cached.
+template <typename V>
+inline KwArg kw(const char *name, const V &value) noexcept
+{
+    return KwArg{name, detail::as_object(value)};
+}
+
+
+namespace detail {
+
+inline PyObject* as_object(const KwArg &arg) noexcept { return arg.value; }
+
+template <typename V>
+inline const char* kw_name(const V &) noexcept { return nullptr; }
+inline const char* kw_name(const KwArg &arg) noexcept { return arg.name; }
+
+template <typename T>
+struct is_kw : std::is_same<typename std::decay<T>::type, KwArg> {};
+
+// Number of keyword arguments
+template <typename... Args>
+struct count_kw : std::integral_constant<std::size_t, 0> {};
+
+template <typename First, typename... Rest>
+struct count_kw<First, Rest...>
+    : std::integral_constant<std::size_t,
+                             (is_kw<First>::value ? 1 : 0)
+                             + count_kw<Rest...>::value> {};
+
+// True if no positional argument follows a keyword argument
+template <typename... Args>
+struct kw_last : std::true_type {};
+
+template <typename First, typename... Rest>
+struct kw_last<First, Rest...>
+    : std::integral_constant<bool,
+                             is_kw<First>::value
+                             ? count_kw<Rest...>::value == sizeof...(Rest)
+                             : kw_last<Rest...>::value> {};
+
+// Create a tuple of n interned strings
+inline PyObject* new_kwnames(const char *const *names, std::size_t n)
+{
+    PyObject *kwnames = PyTuple_New(static_cast<Py_ssize_t>(n));
+    if (kwnames == nullptr) {
+        return nullptr;
+    }
+    for (std::size_t i = 0; i < n; i++) {
+        PyObject *name = PyUnicode_InternFromString(names[i]);
+        if (name == nullptr) {
+            Py_DECREF(kwnames);
+            return nullptr;
+        }
+        PyTuple_SET_ITEM(kwnames, static_cast<Py_ssize_t>(i), name);
+    }
+    return kwnames;
+}
+
+// Cache of the tuple of keyword names of a call site. Static KwNamesCache
+// variables are zero-initialized: no guard is needed to initialize them.
+template <std::size_t N>
+struct KwNamesCache {
+    PyInterpreterState *interp;
+    const char *names[N];
+    PyObject *kwnames;    // strong reference
+};
+
+template <>
+struct KwNamesCache<0> {};
+
+// Get the tuple of the N keyword names: store a strong reference in owner,
+// so the tuple is kept alive during the whole call, and return a borrowed
+// reference. Raise an exception and return NULL on error.
+//
+// The cache is filled by the first call and is never replaced. Calls with
+// different names, or in another interpreter than the first one, create a new
+// tuple. The cache is not thread-safe: it's not used on the free-threaded
+// build.
+template <std::size_t N>
+inline PyObject* get_kwnames(KwNamesCache<N> &cache, const char *const *names,
+                             Ref<> &owner)
+{
+#ifdef Py_GIL_DISABLED
+    (void)cache;
+    owner = Ref<>::steal(new_kwnames(names, N));
+    return owner.get();
+#else
+    PyInterpreterState *interp = PyInterpreterState_Get();
+    if (cache.kwnames != nullptr) {
+        if (interp == cache.interp
+            && std::equal(names, names + N, cache.names)) {
+            owner = Ref<>::new_ref(cache.kwnames);
+        }
+        else {
+            owner = Ref<>::steal(new_kwnames(names, N));
+        }
+        return owner.get();
+    }
+
+    owner = Ref<>::steal(new_kwnames(names, N));
+    if (!owner) {
+        return nullptr;
+    }
+    std::copy(names, names + N, cache.names);
+    cache.interp = interp;
+    cache.kwnames = Py_NewRef(owner.get());
+    return owner.get();
+#endif
+}
+
+inline PyObject* get_kwnames(KwNamesCache<0> &, const char *const *,
+                             Ref<> &) noexcept
+{
+    return nullptr;
+}
+
+// Type of the kwnames cache of a call: only used by decltype()
+template <typename F, typename... Args>
+KwNamesCache<count_kw<Args...>::value>
+kwnames_cache_type(const F &, const Args &...);
+
+template <typename F, typename... Args>
+inline Ref<> call_cached(KwNamesCache<count_kw<Args...>::value> &cache,
+                         const F &func, const Args &... args)
+{
+    static_assert(kw_last<Args...>::value,
+                  "keyword arguments must follow positional arguments");
+    constexpr std::size_t nargs = sizeof...(Args);
+    constexpr std::size_t nkw = count_kw<Args...>::value;
+
+    // stack[0] is the PY_VECTORCALL_ARGUMENTS_OFFSET slot
+    std::array<PyObject*, 1 + nargs> stack = {{
+        nullptr, as_object(args)...}};
+    for (std::size_t i = 1; i < stack.size(); i++) {
+        if (stack[i] == nullptr) {
+            if (!PyErr_Occurred()) {
+                PyErr_BadInternalCall();
+            }
+            return Ref<>();
+        }
+    }
+
+    std::array<const char*, nargs> names = {{kw_name(args)...}};
+    Ref<> owner;
+    PyObject *kwnames = get_kwnames(cache, names.data() + (nargs - nkw),
+                                    owner);
+    if (nkw != 0 && kwnames == nullptr) {
+        return Ref<>();
+    }
+
+    size_t nargsf = (nargs - nkw) | PY_VECTORCALL_ARGUMENTS_OFFSET;
+    return Ref<>::steal(PyObject_Vectorcall(as_object(func),
+                                            stack.data() + 1, nargsf,
+                                            kwnames));
+}
+
+}  // namespace detail
+
+
+// Call func with positional arguments followed by keyword arguments created
+// by kw(). Arguments are PyObject*, Ref or BorrowedRef objects.
+//
+// Arguments are stored in a std::array on the stack with a free slot before
+// the first argument: the PY_VECTORCALL_ARGUMENTS_OFFSET flag is set. The
+// tuple of keyword names is cached per call() instantiation: call sites
+// passing the same argument types share the cache, only the names of the
+// first call are cached. Use PYCOMPAT_CALL() to get a cache per call site.
+//
+// If an argument is NULL, return NULL: an exception must be set.
+//
+// Example: pycompat::call(func, a, b, pycompat::kw("x", y))
+template <typename F, typename... Args>
+inline Ref<> call(const F &func, const Args &... args)
+{
+    static detail::KwNamesCache<detail::count_kw<Args...>::value> cache;
+    return detail::call_cached(cache, func, args...);
+}
+
+// Similar to pycompat::call(), but each PYCOMPAT_CALL() call site has its own
+// cache of keyword names.
+//
+// Example: PYCOMPAT_CALL(func, a, b, pycompat::kw("x", y))
+#define PYCOMPAT_CALL(...) \
+    ([&]() -> ::pycompat::Ref<> { \
+        static decltype(::pycompat::detail::kwnames_cache_type(__VA_ARGS__)) \
+            pycompat_cache; \
+        return ::pycompat::detail::call_cached(pycompat_cache, __VA_ARGS__); \
+    }())
+
+
+namespace detail {
+
+// Number of interpreters cached by a NameCache
+constexpr int name_cache_size = 4;
+
+// Cache of an interned string for up to name_cache_size interpreters. Static
+// NameCache variables are zero-initialized: no guard is needed to initialize
+// them. Entries are published with atomic operations: the cache can be used
+// by threads of subinterpreters having their own GIL, and on the
+// free-threaded build.
+struct NameCache {
+    struct Entry {
+        std::atomic<std::intptr_t> interp;  // interp_key(), 0 if unused
+        std::atomic<PyObject*> name;         // strong reference
+    };
+    Entry entries[name_cache_size];
+};
+
+// Get a key identifying the current interpreter, never zero.
+//
+// Since Python 3.7, use the interpreter ID: it's not reused by another
+// interpreter, whereas the memory of a destroyed interpreter can be reused.
+// Before Python 3.7, interned strings are shared by all interpreters.
+inline std::intptr_t interp_key()
+{
+    PyInterpreterState *interp = PyInterpreterState_Get();
+#if PY_VERSION_HEX >= 0x03070000 && !defined(PYPY_VERSION)
+    return static_cast<std::intptr_t>(PyInterpreterState_GetID(interp)) + 1;
+#else
+    return reinterpret_cast<std::intptr_t>(interp);
+#endif
+}
+
+// Interned string of a call site used by more than name_cache_size
+// interpreters: store it in the interpreter dictionary, with the cache
+// address as key, to keep it alive. Before Python 3.8, use the thread state
+// dictionary.
+//
+// Only the key is created at each call: the string is not decoded again.
+inline PyObject* name_uncached(NameCache &cache, const char *str)
+{
+#if PY_VERSION_HEX >= 0x03080000 && !defined(PYPY_VERSION)
+    PyObject *dict = PyInterpreterState_GetDict(PyInterpreterState_Get());
+#else
+    PyObject *dict = PyThreadState_GetDict();
+#endif
+    if (dict == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "cannot get the names dict");
+        return nullptr;
+    }
+
+    Ref<> key = Ref<>::steal(PyLong_FromVoidPtr(&cache));
+    if (!key) {
+        return nullptr;
+    }
+    PyObject *name;
+    if (PyDict_GetItemRef(dict, key.get(), &name) < 0) {
+        return nullptr;
+    }
+    if (name == nullptr) {
+        Ref<> new_name = Ref<>::steal(PyUnicode_InternFromString(str));
+        if (!new_name) {
+            return nullptr;
+        }
+        // Another thread can store the string concurrently
+        if (PyDict_SetDefaultRef(dict, key.get(), new_name.get(), &name) < 0) {
+            return nullptr;
+        }
+    }
+    // Borrowed reference kept alive by the dict
+    Py_DECREF(name);
+    return name;
+}
+
+// Get the interned string of str: return a borrowed reference.
+// Raise an exception and return NULL on error.
+//
+// The first call in an interpreter claims a free entry with a compare and
+// swap, creates the string and publishes it with a release store. If the
+// string is being created by another thread, or if all entries are used by
+// other interpreters, call name_uncached().
+inline PyObject* name_get(NameCache &cache, const char *str)
+{
+    std::intptr_t key = interp_key();
+    for (NameCache::Entry &entry : cache.entries) {
+        std::intptr_t entry_key = entry.interp.load(std::memory_order_acquire);
+        if (entry_key == 0) {
+            if (entry.interp.compare_exchange_strong(
+                    entry_key, key, std::memory_order_acq_rel)) {
+                PyObject *name = PyUnicode_InternFromString(str);
+                if (name == nullptr) {
+                    // Release the entry
+                    entry.interp.store(0, std::memory_order_release);
+                    return nullptr;
+                }
+                entry.name.store(name, std::memory_order_release);
+                return name;
+            }
+            // entry_key is now the key of the interpreter which claimed the
+            // entry
+        }
+        if (entry_key == key) {
+            PyObject *name = entry.name.load(std::memory_order_acquire);
+            if (name != nullptr) {
+                return name;
+            }
+            break;
+        }
+    }
+    return name_uncached(cache, str);
+}
+
+}  // namespace detail
+
+
+// Get the interned string of a string literal: return a borrowed reference.
+// The string is created and hashed at the first call, next calls in the same
+// interpreter return the same object. Raise an exception and return NULL on
+// error.
+//
+// Each PYCOMPAT_NAME() call site has its own cache.
+//
+// Example: PyObject_GetOptionalAttr(obj, PYCOMPAT_NAME("attr"), &value)
+#define PYCOMPAT_NAME(str) \
+    ([]() -> PyObject* { \
+        static ::pycompat::detail::NameCache pycompat_cache; \
+        return ::pycompat::detail::name_get(pycompat_cache, "" str); \
+    }())
+
+
+// C++20 class types as non-type template parameters
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+namespace detail {
+
+template <std::size_t N>
+struct FixedString {
+    char value[N];
+
+    constexpr FixedString(const char (&str)[N]) noexcept : value() {
+        for (std::size_t i = 0; i < N; i++) {
+            value[i] = str[i];
+        }
+    }
+};
+
+}  // namespace detail
+
+// Similar to PYCOMPAT_NAME(), but each string literal has its own cache.
+//
+// Example: PyObject_GetOptionalAttr(obj, pycompat::name<"attr">(), &value)
+template <detail::FixedString S>
+inline PyObject* name()
+{
+    static detail::NameCache cache;
+    return detail::name_get(cache, S.value);
+}
+#endif
+
+}  // namespace pycompat
+
+#endif  // PYTHONCAPI_COMPAT_HPP
@@ -6,14 +6,27 @@ Usage::
 
     python3 test_matrix.py
     python3 test_matrix.py -v # verbose mode
+    python3 runtests.py --codegen # also check the generated machine code
+    python3 runtests.py --bench # run benchmarks, compare to the baseline
+    python3 runtests.py --bench --compile # compilation benchmark
+
+In the --bench mode, the cost of each benchmark relative to its "_ref"
+reference benchmark is compared to the baseline of the same Python version.
+Fail if the relative cost increased by more than the threshold, or if a
+benchmark has no reference benchmark. If the baseline file doesn't exist,
+create it. With --compile, the compilation cost of pythoncapi_compat.h is
+compared instead.
 """
 from __future__ import absolute_import
 from __future__ import print_function
 import argparse
+import json
+import os
 import os.path
 import shutil
 import subprocess
 import sys
+import tempfile
 try:
     from shutil import which
 except ImportError:
@@ -27,6 +40,14 @@ from tests.utils import run_command
 TEST_DIR = os.path.join(os.path.dirname(__file__), 'tests')
 TEST_COMPAT = os.path.join(TEST_DIR, "test_pythoncapi_compat.py")
 TEST_UPGRADE = os.path.join(TEST_DIR, "test_upgrade_pythoncapi.py")
+TEST_CODEGEN = os.path.join(TEST_DIR, "test_codegen.py")
+BENCH = os.path.join(TEST_DIR, "bench_pythoncapi_compat.py")
+BENCH_COMPILE = os.path.join(TEST_DIR, "bench_compile.py")
+BENCH_BASELINE = os.path.join(os.path.dirname(__file__), "bench_baseline.json")
+# Default threshold of the --bench mode in percent
+BENCH_THRESHOLD = 50.0
+# Reference benchmarks faster than 1 ns are too short to be compared reliably
+BENCH_MIN_NSEC = 1.0
 
 PYTHONS = (
     "python3-debug",
@@ -41,6 +62,9 @@ PYTHONS = (
     "python3.10",
     "python3.11",
     "python3.12",
+    "python3.13",
+    # Free-threaded build
+    "python3.13t",
     "pypy",
     "pypy2",
     "pypy2.7",
@@ -52,26 +76,166 @@ PYTHONS = (
 )
 
 
-def run_tests_exe(executable, verbose, tested):
+def run_tests_exe(executable, args, tested):
     tested_key = os.path.realpath(executable)
     if tested_key in tested:
         return
 
+    # test_codegen.py depends on the compiler and its optimizations, not only
+    # on pythoncapi_compat.h: only run it with --codegen
+    tests = [TEST_COMPAT]
+    if args.codegen:
+        tests.append(TEST_CODEGEN)
+
     # Don't use realpath() for the executed command to support virtual
     # environments
-    cmd = [executable, TEST_COMPAT]
-    if verbose:
+    for test in tests:
+        cmd = [executable, test]
+        if args.verbose:
+            cmd.append('-v')
+        run_command(cmd)
+    tested.add(tested_key)
+
+
+def run_bench_exe(executable, args, json_filename, tested):
+    tested_key = os.path.realpath(executable)
+    if tested_key in tested:
+        return
+
+    if args.compile:
+        cmd = [executable, BENCH_COMPILE, '--json', json_filename]
+    else:
+        cmd = [executable, BENCH, '--json', json_filename]
+    if args.instructions:
+        cmd.append('--instructions')
+    if args.verbose:
         cmd.append('-v')
     run_command(cmd)
     tested.add(tested_key)
 
 
-def run_tests(python, verbose, tested):
+def run_tests(python, args, tested):
     executable = which(python)
     if not executable:
         print("Ignore missing Python executable: %s" % python)
         return
-    run_tests_exe(executable, verbose, tested)
+    run_tests_exe(executable, args, tested)
+
+
+def get_ratios(version, results, key):
+    # Return a dict: benchmark name => cost relative to the reference.
+    # Fail if a benchmark has no "_ref" reference benchmark.
+    ratios = {}
+    missing = []
+    for name, value in results.items():
+        if name.endswith('_ref'):
+            continue
+        ref = results.get(name + '_ref')
+        if ref is None:
+            missing.append(name)
+            continue
+        if key == 'instructions':
+            value = value['instructions']
+            ref = ref['instructions']
+        elif ref < BENCH_MIN_NSEC:
+            continue
+        if ref <= 0:
+            continue
+        ratios[name] = float(value) / ref
+    if missing:
+        print("ERROR: %s: benchmarks without _ref reference: %s"
+              % (version, ', '.join(sorted(missing))))
+        sys.exit(1)
+    return ratios
+
+
+def compare_baseline(ratios, baseline, threshold):
+    # Return the number of regressions
+    regressions = 0
+    for version in sorted(ratios):
+        if version not in baseline:
+            continue
+        base = baseline[version]
+        for name in sorted(ratios[version]):
+            if name not in base:
+                continue
+            ratio = ratios[version][name]
+            change = (ratio / base[name] - 1.0) * 100
+            if change > threshold:
+                regressions += 1
+                status = "REGRESSION"
+            else:
+                status = "ok"
+            print("%s: %s: x%.2f of ref (baseline: x%.2f, %+.0f%%): %s"
+                  % (version, name, ratio, base[name], change, status))
+    return regressions
+
+
+def run_bench(args, pythons):
+    if args.compile:
+        key = 'compile'
+    elif args.instructions:
+        key = 'instructions'
+    else:
+        key = 'benchmarks'
+    fd, json_filename = tempfile.mkstemp(suffix='.json')
+    os.close(fd)
+    os.unlink(json_filename)
+    try:
+        tested = set()
+        for python in pythons:
+            executable = which(python)
+            if not executable:
+                print("Ignore missing Python executable: %s" % python)
+                continue
+            run_bench_exe(executable, args, json_filename, tested)
+        run_bench_exe(sys.executable, args, json_filename, tested)
+
+        with open(json_filename) as fp:
+            results = json.load(fp)
+    finally:
+        if os.path.exists(json_filename):
+            os.unlink(json_filename)
+    print()
+
+    ratios = {}
+    for version, entry in results.items():
+        ratios[version] = get_ratios(version, entry[key], key)
+
+    # The baseline file maps "benchmarks", "instructions" or "compile" to
+    # a dict: Python version => benchmark name => relative cost
+    baseline_filename = args.baseline
+    data = {}
+    if os.path.exists(baseline_filename):
+        with open(baseline_filename) as fp:
+            data = json.load(fp)
+    baseline = data.setdefault(key, {})
+
+    regressions = 0
+    if not args.update_baseline:
+        regressions = compare_baseline(ratios, baseline, args.threshold)
+        print()
+
+    # Add Python versions missing in the baseline
+    if args.update_baseline:
+        new_versions = sorted(ratios)
+    else:
+        new_versions = sorted(set(ratios) - set(baseline))
+    if new_versions:
+        for version in new_versions:
+            baseline[version] = ratios[version]
+        with open(baseline_filename, 'w') as fp:
+            json.dump(data, fp, indent=4, sort_keys=True)
+            fp.write('\n')
+        print("Baseline of %s written into %s"
+              % (', '.join(new_versions), baseline_filename))
+
+    if regressions:
+        print("ERROR: %s benchmark regressions (threshold: %s%%)"
+              % (regressions, args.threshold))
+        sys.exit(1)
+    if not args.update_baseline:
+        print("No benchmark regression (threshold: %s%%)" % args.threshold)
 
 
 def parse_args():
@@ -81,16 +245,44 @@ def parse_args():
     parser.add_argument('-c', '--current', action="store_true",
                         help="Only test the current Python executable "
                              "(don't test multiple Python versions)")
+    parser.add_argument('--codegen', action="store_true",
+                        help="Also check the machine code generated for "
+                             "pythoncapi_compat.h functions")
+    parser.add_argument('--bench', action="store_true",
+                        help="Run benchmarks and compare them to the "
+                             "baseline, rather than running tests")
+    parser.add_argument('--baseline', default=BENCH_BASELINE,
+                        metavar='FILENAME',
+                        help='Baseline JSON file of --bench '
+                             '(default: %(default)s)')
+    parser.add_argument('--update-baseline', action="store_true",
+                        help='Write --bench results into the baseline')
+    parser.add_argument('--threshold', type=float, default=BENCH_THRESHOLD,
+                        help='Maximum increase of the relative cost of '
+                             'a benchmark in percent (default: %(default)s)')
+    parser.add_argument('--instructions', action="store_true",
+                        help='Compare instruction counts rather than '
+                             'timings in --bench')
+    parser.add_argument('--compile', action="store_true",
+                        help='Compare the compilation time and memory of '
+                             'pythoncapi_compat.h in --bench')
     return parser.parse_args()
 
 
 def main():
     args = parse_args()
+    if args.compile and args.instructions:
+        print("ERROR: --compile and --instructions are incompatible")
+        sys.exit(1)
 
     path = os.path.join(TEST_DIR, 'build')
     if os.path.exists(path):
         shutil.rmtree(path)
 
+    if args.bench:
+        run_bench(args, () if args.current else PYTHONS)
+        return
+
     # upgrade_pythoncapi.py requires Python 3.6 or newer
     if sys.version_info >= (3, 6):
         print("Run %s" % TEST_UPGRADE)
@@ -105,13 +297,13 @@ def main():
     tested = set()
     if not args.current:
         for python in PYTHONS:
-            run_tests(python, args.verbose, tested)
-        run_tests_exe(sys.executable, args.verbose, tested)
+            run_tests(python, args, tested)
+        run_tests_exe(sys.executable, args, tested)
 
         print()
         print("Tested: %s Python executables" % len(tested))
     else:
-        run_tests_exe(sys.executable, args.verbose, tested)
+        run_tests_exe(sys.executable, args, tested)
 
 
 if __name__ == "__main__":
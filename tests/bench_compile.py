@@ -0,0 +1,185 @@
+#!/usr/bin/python3
+"""
+Benchmark the compilation cost of pythoncapi_compat.h.
+
+Usage::
+
+    python3 bench_compile.py
+    python3 bench_compile.py -v # verbose mode
+    python3 bench_compile.py --json results.json
+    python3 bench_compile.py --header pruned/pythoncapi_compat.h
+
+Compile a translation unit which only includes <Python.h>, and a translation
+unit which also includes pythoncapi_compat.h, with GCC and clang (if
+available), in C and in multiple C++ standards. Measure the CPU time of the
+preprocessor and of the compilation, and the peak memory of the compiler.
+
+Benchmarks with the "_ref" suffix only include <Python.h>. Times are in
+milliseconds, memory in KiB. The JSON file format is the one of
+bench_pythoncapi_compat.py with the "compile" key.
+"""
+from __future__ import absolute_import
+from __future__ import print_function
+import argparse
+import os
+import os.path
+import shutil
+import subprocess
+import sys
+import sysconfig
+import tempfile
+
+# bench_pythoncapi_compat.py and test_codegen.py
+from bench_pythoncapi_compat import write_json
+from test_codegen import get_compilers
+from test_pythoncapi_compat import python_version
+
+
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+SRC_DIR = os.path.dirname(TEST_DIR)
+PYTHONCAPI_COMPAT_H = os.path.join(SRC_DIR, 'pythoncapi_compat.h')
+
+# Languages: (name, C++?, compiler flags)
+LANGUAGES = (
+    ('C', False, ['-std=c99']),
+    ('C++03', True, ['-std=c++03']),
+    ('C++11', True, ['-std=c++11']),
+    ('C++17', True, ['-std=c++17']),
+    ('C++20', True, ['-std=c++20']),
+)
+
+CFLAGS = ['-O2', '-DNDEBUG', '-fPIC']
+
+
+def run_compiler(cmd):
+    # Return (CPU time in milliseconds, peak memory in KiB) of the command.
+    # The resource usage returned by wait4() includes the processes spawned
+    # by the compiler driver (ex: cc1).
+    with open(os.devnull, 'w') as devnull:
+        proc = subprocess.Popen(cmd, stdout=devnull, stderr=devnull)
+        status = os.wait4(proc.pid, 0)[1:]
+    exitcode, rusage = status
+    proc.returncode = exitcode
+    if exitcode:
+        return None
+    cpu_time = (rusage.ru_utime + rusage.ru_stime) * 1e3
+    return (cpu_time, rusage.ru_maxrss)
+
+
+def bench_compiler(cmd, repeat):
+    # Return the fastest run and the smallest peak memory, or None if the
+    # compilation failed
+    best_time = best_rss = None
+    for _ in range(repeat):
+        result = run_compiler(cmd)
+        if result is None:
+            return None
+        cpu_time, rss = result
+        if best_time is None or cpu_time < best_time:
+            best_time = cpu_time
+        if best_rss is None or rss < best_rss:
+            best_rss = rss
+    return (best_time, best_rss)
+
+
+def bench_language(compiler, cplusplus, tmpdir, header, repeat):
+    # Return a dict: metric => (value, reference value)
+    ext = '.cpp' if cplusplus else '.c'
+    ref_filename = os.path.join(tmpdir, 'ref' + ext)
+    with open(ref_filename, 'w') as fp:
+        fp.write('#include <Python.h>\n')
+    compat_filename = os.path.join(tmpdir, 'compat' + ext)
+    with open(compat_filename, 'w') as fp:
+        fp.write('#include <Python.h>\n'
+                 '#include "%s"\n' % os.path.basename(header))
+
+    include_dir = sysconfig.get_paths()['include']
+    cmd = compiler + CFLAGS + ['-I', os.path.dirname(header),
+                               '-I', include_dir]
+    obj_filename = os.path.join(tmpdir, 'probe.o')
+    metrics = {}
+    for filename, index in ((compat_filename, 0), (ref_filename, 1)):
+        preprocess = bench_compiler(cmd + ['-E', filename,
+                                           '-o', os.devnull], repeat)
+        compile = bench_compiler(cmd + ['-c', filename,
+                                        '-o', obj_filename], repeat)
+        if preprocess is None or compile is None:
+            return None
+        for name, value in (('preprocess', preprocess[0]),
+                            ('compile', compile[0]),
+                            ('maxrss', compile[1])):
+            metrics.setdefault(name, [None, None])[index] = value
+    return metrics
+
+
+def run_benchmarks(header, repeat, verbose):
+    # Python.h only supports C++ on Python 3.6 and newer
+    support_cxx = (sys.version_info >= (3, 6))
+
+    print("%s: compile %s" % (python_version(), header))
+    results = {}
+    tmpdir = tempfile.mkdtemp()
+    try:
+        for compiler_name, cc, cxx in get_compilers():
+            for lang, cplusplus, flags in LANGUAGES:
+                compiler = cxx if cplusplus else cc
+                if compiler is None or (cplusplus and not support_cxx):
+                    continue
+                label = '%s %s' % (compiler_name, lang)
+                if verbose:
+                    print("Benchmark %s ..." % label)
+                metrics = bench_language(compiler + flags, cplusplus, tmpdir,
+                                         header, repeat)
+                if metrics is None:
+                    print("%s: skip, compilation failed" % label)
+                    continue
+
+                prefix = '%s_%s' % (compiler_name, lang.lower())
+                for name, (value, ref) in sorted(metrics.items()):
+                    results['%s_%s' % (prefix, name)] = value
+                    results['%s_%s_ref' % (prefix, name)] = ref
+                preprocess = metrics['preprocess']
+                compile = metrics['compile']
+                maxrss = metrics['maxrss']
+                print("%s: preprocess %.1f ms (%+.1f ms), "
+                      "compile %.1f ms (%+.1f ms), "
+                      "max RSS %.1f MiB (%+.1f MiB)"
+                      % (label,
+                         preprocess[0], preprocess[0] - preprocess[1],
+                         compile[0], compile[0] - compile[1],
+                         maxrss[0] / 1024., (maxrss[0] - maxrss[1]) / 1024.))
+                sys.stdout.flush()
+    finally:
+        shutil.rmtree(tmpdir)
+    return results
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-v', '--verbose', action="store_true",
+                        help='Verbose mode')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+                        help='Number of runs, keep the fastest '
+                             '(default: %(default)s)')
+    parser.add_argument('--header', default=PYTHONCAPI_COMPAT_H,
+                        metavar='FILENAME',
+                        help='pythoncapi_compat.h file (default: the file '
+                             'of the parent directory)')
+    parser.add_argument('--json', metavar='FILENAME',
+                        help='Write results into a JSON file')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    header = os.path.abspath(args.header)
+    results = run_benchmarks(header, args.repeat, args.verbose)
+    if not results:
+        print("ERROR: no C compiler found")
+        sys.exit(1)
+    if args.json:
+        write_json(os.path.abspath(args.json), 'compile', results)
+
+
+if __name__ == "__main__":
+    main()
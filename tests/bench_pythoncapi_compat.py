@@ -0,0 +1,279 @@
+#!/usr/bin/python3
+"""
+Run micro-benchmarks of pythoncapi_compat.h functions.
+
+Usage::
+
+    python3 bench_pythoncapi_compat.py
+    python3 bench_pythoncapi_compat.py -v # verbose mode
+    python3 bench_pythoncapi_compat.py --json results.json
+    python3 bench_pythoncapi_compat.py --instructions
+
+Benchmarks with the "_ref" suffix run the reference code of the benchmark
+without the suffix: the native function, or the code written without
+pythoncapi_compat.h.
+
+The mutex_contention_<N>threads benchmarks run N threads locking the same
+PyMutex: the time is the wall-clock time divided by the total number of
+lock/unlock operations. The "_ref" benchmarks use a PyThread_type_lock.
+
+The --instructions option counts user-space instructions and branches per
+operation, rather than measuring the time: the result doesn't depend on the
+system load. Counters are read with the Linux perf_event_open() syscall. If
+perf counters are not available, run each benchmark under the valgrind
+cachegrind tool.
+
+The JSON file maps a Python version to a dict of benchmark name => nanoseconds
+per operation ("benchmarks" key), and benchmark name => {"instructions": ...,
+"branches": ...} per operation ("instructions" key). Results of other Python
+versions are kept, to run the benchmarks on multiple Python versions with the
+same JSON file.
+"""
+from __future__ import absolute_import
+from __future__ import print_function
+import argparse
+import json
+import os
+import os.path
+import platform
+import subprocess
+import sys
+import tempfile
+try:
+    from time import perf_counter
+except ImportError:
+    # Python 2
+    from time import time as perf_counter
+
+try:
+    from shutil import which
+except ImportError:
+    # Python 2
+    from distutils.spawn import find_executable as which
+
+# test_pythoncapi_compat.py
+import test_pythoncapi_compat
+from test_pythoncapi_compat import build_ext, import_tests, python_version
+
+
+BENCH_MODULE = "bench_pythoncapi_compat_cext"
+# Number of threads of mutex contention benchmarks
+CONTENTION_THREADS = (1, 2, 4, 8)
+SCRIPT = os.path.abspath(__file__)
+
+
+def bench_func(func, loops, repeat):
+    best = None
+    for _ in range(repeat):
+        t0 = perf_counter()
+        func(loops)
+        dt = perf_counter() - t0
+        if best is None or dt < best:
+            best = dt
+    # nanoseconds per operation
+    return best * 1e9 / loops
+
+
+def run_func(func, loops):
+    # Frame benchmarks read the "loops" variable of the caller frame
+    func(loops)
+
+
+def perf_counters_func(benchmod, func, loops, repeat):
+    # Subtract the counters of func(0) to ignore the cost of the function call
+    best = None
+    for _ in range(repeat):
+        instructions, branches = benchmod.perf_counters(func, loops)
+        instructions0, branches0 = benchmod.perf_counters(func, 0)
+        counts = (instructions - instructions0, branches - branches0)
+        if best is None or counts < best:
+            best = counts
+    return (float(best[0]) / loops, float(best[1]) / loops)
+
+
+def parse_cachegrind(filename):
+    # Return the (instructions, branches) tuple of the summary
+    events = summary = None
+    with open(filename) as fp:
+        for line in fp:
+            if line.startswith('events:'):
+                events = line.split()[1:]
+            elif line.startswith('summary:'):
+                summary = [int(value) for value in line.split()[1:]]
+    if events is None or summary is None:
+        raise Exception("failed to parse cachegrind output: %s" % filename)
+    counts = dict(zip(events, summary))
+    # Conditional and indirect branches
+    branches = counts.get('Bc', 0) + counts.get('Bi', 0)
+    return (counts['Ir'], branches)
+
+
+def cachegrind_run(valgrind, name, loops):
+    fd, filename = tempfile.mkstemp(prefix='cachegrind.')
+    os.close(fd)
+    try:
+        cmd = [valgrind, '--tool=cachegrind', '--cache-sim=no',
+               '--branch-sim=yes', '--cachegrind-out-file=%s' % filename,
+               sys.executable, SCRIPT, '--run', name, '--loops', str(loops)]
+        # Disable hash randomization to get reproducible counters
+        env = dict(os.environ, PYTHONHASHSEED='0')
+        with open(os.devnull, 'w') as devnull:
+            subprocess.check_call(cmd, env=env, stdout=devnull,
+                                  stderr=devnull)
+        return parse_cachegrind(filename)
+    finally:
+        os.unlink(filename)
+
+
+def cachegrind_func(valgrind, name, loops):
+    # Subtract the counters of a run with loops=0 to ignore Python startup
+    instructions, branches = cachegrind_run(valgrind, name, loops)
+    instructions0, branches0 = cachegrind_run(valgrind, name, 0)
+    return (float(instructions - instructions0) / loops,
+            float(branches - branches0) / loops)
+
+
+def get_counters_func(benchmod):
+    # Return a function func(name, loops, repeat) counting instructions and
+    # branches per operation
+    error = "perf_event_open() is not available"
+    if hasattr(benchmod, 'perf_counters'):
+        try:
+            benchmod.perf_counters(benchmod.bench_newref, 0)
+        except OSError as exc:
+            error = "perf_event_open() failed: %s" % exc
+        else:
+            def counters_func(name, loops, repeat):
+                return perf_counters_func(benchmod, getattr(benchmod, name),
+                                          loops, repeat)
+            return counters_func
+
+    valgrind = which('valgrind')
+    if valgrind is None:
+        print("ERROR: cannot count instructions: %s and valgrind is missing"
+              % error)
+        sys.exit(1)
+    print("%s: use valgrind" % error)
+
+    def counters_func(name, loops, repeat):
+        # valgrind is deterministic: don't repeat runs
+        return cachegrind_func(valgrind, name, loops)
+    return counters_func
+
+
+def list_benchmarks(benchmod):
+    return sorted(name for name in dir(benchmod)
+                  if name.startswith("bench_"))
+
+
+def run_benchmarks(loops, repeat):
+    benchmod = import_tests(BENCH_MODULE)
+    names = list_benchmarks(benchmod)
+
+    print("%s: %s benchmarks" % (python_version(), len(names)))
+    results = {}
+    for name in names:
+        func = getattr(benchmod, name)
+        nsec = bench_func(func, loops, repeat)
+        name = name[len("bench_"):]
+        results[name] = nsec
+        print("%s: %.1f ns" % (name, nsec))
+        sys.stdout.flush()
+
+    if hasattr(benchmod, 'mutex_contention'):
+        # Contended locks are slower: use less loops
+        loops = max(loops // 10, 1)
+        for nthreads in CONTENTION_THREADS:
+            for ref in (False, True):
+                def func(loops):
+                    benchmod.mutex_contention(nthreads, loops, ref)
+                nsec = bench_func(func, loops, repeat) / nthreads
+                name = 'mutex_contention_%sthreads' % nthreads
+                if ref:
+                    name += '_ref'
+                results[name] = nsec
+                print("%s: %.1f ns" % (name, nsec))
+                sys.stdout.flush()
+    return results
+
+
+def count_instructions(loops, repeat):
+    benchmod = import_tests(BENCH_MODULE)
+    names = list_benchmarks(benchmod)
+    counters_func = get_counters_func(benchmod)
+
+    print("%s: %s benchmarks" % (python_version(), len(names)))
+    results = {}
+    for name in names:
+        instructions, branches = counters_func(name, loops, repeat)
+        name = name[len("bench_"):]
+        results[name] = {'instructions': instructions, 'branches': branches}
+        print("%s: %.1f instructions, %.1f branches"
+              % (name, instructions, branches))
+        sys.stdout.flush()
+    return results
+
+
+def write_json(filename, key, results):
+    data = {}
+    if os.path.exists(filename):
+        with open(filename) as fp:
+            data = json.load(fp)
+    entry = data.setdefault(python_version(), {})
+    entry['python'] = platform.python_version()
+    entry[key] = results
+    with open(filename, 'w') as fp:
+        json.dump(data, fp, indent=4, sort_keys=True)
+        fp.write('\n')
+    print("Results written into %s" % filename)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-v', '--verbose', action="store_true",
+                        help='Verbose mode')
+    parser.add_argument('-l', '--loops', type=int, default=10 ** 5,
+                        help='Number of loops per run (default: %(default)s)')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+                        help='Number of runs, keep the fastest '
+                             '(default: %(default)s)')
+    parser.add_argument('--json', metavar='FILENAME',
+                        help='Write results into a JSON file')
+    parser.add_argument('--instructions', action="store_true",
+                        help='Count instructions and branches per operation')
+    # Internal option used by the valgrind runs: run a single benchmark
+    parser.add_argument('--run', metavar='NAME',
+                        help=argparse.SUPPRESS)
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    test_pythoncapi_compat.VERBOSE = args.verbose
+    json_filename = None
+    if args.json:
+        json_filename = os.path.abspath(args.json)
+
+    src_dir = os.path.dirname(__file__)
+    if src_dir:
+        os.chdir(src_dir)
+
+    if args.run:
+        # The extension is already built
+        benchmod = import_tests(BENCH_MODULE)
+        run_func(getattr(benchmod, args.run), args.loops)
+        return
+
+    build_ext()
+    if args.instructions:
+        results = count_instructions(args.loops, args.repeat)
+        key = 'instructions'
+    else:
+        results = run_benchmarks(args.loops, args.repeat)
+        key = 'benchmarks'
+    if json_filename:
+        write_json(json_filename, key, results)
+
+
+if __name__ == "__main__":
+    main()
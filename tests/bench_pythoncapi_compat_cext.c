@@ -0,0 +1,1663 @@
+// Micro-benchmarks of pythoncapi_compat.h functions.
+//
+// Each bench_xxx(loops) function runs its operation "loops" times in a tight
+// C loop. The timing is done by bench_pythoncapi_compat.py.
+//
+// mutex_contention(nthreads, loops, ref) runs "nthreads" threads locking
+// a shared PyMutex (or a PyThread_type_lock if ref is true) "loops" times.
+//
+// On Linux, perf_counters(func, loops) counts user-space instructions and
+// branches of func(loops) using perf_event_open().
+
+// Enable opt-in optimizations
+#define PYTHONCAPI_COMPAT_FAST_LOCALS
+
+#include "pythoncapi_compat.h"
+#include "pythread.h"                // PyThread_start_new_thread()
+
+#if PY_VERSION_HEX >= 0x03000000
+#  define PYTHON3 1
+#endif
+
+#define MODULE_NAME bench_pythoncapi_compat_cext
+#define _STR(NAME) #NAME
+#define STR(NAME) _STR(NAME)
+#define _CONCAT(a, b) a ## b
+#define CONCAT(a, b) _CONCAT(a, b)
+
+#define MODULE_NAME_STR STR(MODULE_NAME)
+
+#ifdef __linux__
+#  include <errno.h>
+#  include <string.h>             // memset()
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>        // __NR_perf_event_open
+#  include <unistd.h>             // syscall()
+#  define HAVE_PERF_EVENT
+#endif
+
+
+static int
+parse_loops(PyObject *args, Py_ssize_t *loops)
+{
+    return PyArg_ParseTuple(args, "n", loops);
+}
+
+
+// Create a Python function: calling it doesn't need to pack arguments into
+// a tuple on Python 3.6 and newer.
+static PyObject*
+create_py_func(const char *code)
+{
+    PyObject *globals, *func;
+
+    globals = PyDict_New();
+    if (globals == _Py_NULL) {
+        return _Py_NULL;
+    }
+    if (PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins()) < 0) {
+        Py_DECREF(globals);
+        return _Py_NULL;
+    }
+    func = PyRun_String(code, Py_eval_input, globals, globals);
+    Py_DECREF(globals);
+    return func;
+}
+
+
+// PyObject_Vectorcall() with 2 positional arguments
+static PyObject *
+bench_vectorcall(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *func, *res;
+    PyObject *stack[2];
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    func = create_py_func("lambda a, b: None");
+    if (func == _Py_NULL) {
+        return _Py_NULL;
+    }
+    stack[0] = Py_None;
+    stack[1] = Py_None;
+
+    for (i = 0; i < loops; i++) {
+        res = PyObject_Vectorcall(func, stack, 2, _Py_NULL);
+        if (res == _Py_NULL) {
+            Py_DECREF(func);
+            return _Py_NULL;
+        }
+        Py_DECREF(res);
+    }
+    Py_DECREF(func);
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_vectorcall(): pack arguments into a new tuple and call
+// PyObject_Call(), as the PyObject_Vectorcall() fallback does on Python 3.5
+// and older.
+static PyObject *
+bench_vectorcall_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *func, *posargs, *res;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    func = create_py_func("lambda a, b: None");
+    if (func == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        posargs = PyTuple_New(2);
+        if (posargs == _Py_NULL) {
+            Py_DECREF(func);
+            return _Py_NULL;
+        }
+        PyTuple_SET_ITEM(posargs, 0, Py_NewRef(Py_None));
+        PyTuple_SET_ITEM(posargs, 1, Py_NewRef(Py_None));
+        res = PyObject_Call(func, posargs, _Py_NULL);
+        Py_DECREF(posargs);
+        if (res == _Py_NULL) {
+            Py_DECREF(func);
+            return _Py_NULL;
+        }
+        Py_DECREF(res);
+    }
+    Py_DECREF(func);
+    Py_RETURN_NONE;
+}
+
+
+// PyObject_Vectorcall() with 1 positional argument and 1 keyword argument
+static PyObject *
+bench_vectorcall_kwnames(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *func, *kwnames, *res;
+    PyObject *stack[2];
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    func = create_py_func("lambda a, b: None");
+    if (func == _Py_NULL) {
+        return _Py_NULL;
+    }
+    kwnames = Py_BuildValue("(s)", "b");
+    if (kwnames == _Py_NULL) {
+        Py_DECREF(func);
+        return _Py_NULL;
+    }
+    stack[0] = Py_None;
+    stack[1] = Py_None;
+
+    for (i = 0; i < loops; i++) {
+        res = PyObject_Vectorcall(func, stack, 1, kwnames);
+        if (res == _Py_NULL) {
+            Py_DECREF(kwnames);
+            Py_DECREF(func);
+            return _Py_NULL;
+        }
+        Py_DECREF(res);
+    }
+    Py_DECREF(kwnames);
+    Py_DECREF(func);
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_vectorcall_kwnames(): pack arguments into a new tuple
+// and a new dict, and call PyObject_Call().
+static PyObject *
+bench_vectorcall_kwnames_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *func, *posargs, *kwargs, *res;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    func = create_py_func("lambda a, b: None");
+    if (func == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        posargs = PyTuple_New(1);
+        if (posargs == _Py_NULL) {
+            goto error;
+        }
+        PyTuple_SET_ITEM(posargs, 0, Py_NewRef(Py_None));
+        kwargs = PyDict_New();
+        if (kwargs == _Py_NULL) {
+            Py_DECREF(posargs);
+            goto error;
+        }
+        if (PyDict_SetItemString(kwargs, "b", Py_None) < 0) {
+            Py_DECREF(posargs);
+            Py_DECREF(kwargs);
+            goto error;
+        }
+        res = PyObject_Call(func, posargs, kwargs);
+        Py_DECREF(posargs);
+        Py_DECREF(kwargs);
+        if (res == _Py_NULL) {
+            goto error;
+        }
+        Py_DECREF(res);
+    }
+    Py_DECREF(func);
+    Py_RETURN_NONE;
+
+error:
+    Py_DECREF(func);
+    return _Py_NULL;
+}
+
+
+static PyObject*
+create_dict_with_key(PyObject **key, PyObject **missing_key)
+{
+    PyObject *dict = Py_BuildValue("{sO}", "key", Py_None);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+    *key = Py_BuildValue("s", "key");
+    *missing_key = Py_BuildValue("s", "missing_key");
+    if (*key == _Py_NULL || *missing_key == _Py_NULL) {
+        Py_DECREF(dict);
+        Py_XDECREF(*key);
+        Py_XDECREF(*missing_key);
+        return _Py_NULL;
+    }
+    return dict;
+}
+
+
+static PyObject *
+bench_mapping_getoptionalitem(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *lookup_key, *item;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_key = (hit ? key : missing_key);
+
+    for (i = 0; i < loops; i++) {
+        res = PyMapping_GetOptionalItem(dict, lookup_key, &item);
+        if (res < 0) {
+            break;
+        }
+        Py_XDECREF(item);
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_mapping_getoptionalitem(): PyObject_GetItem() and
+// clear KeyError if the key is missing, as PyMapping_GetOptionalItem() does
+// on non-dict objects.
+static PyObject *
+bench_mapping_getoptionalitem_ref(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *lookup_key, *item;
+    int error = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_key = (hit ? key : missing_key);
+
+    for (i = 0; i < loops; i++) {
+        item = PyObject_GetItem(dict, lookup_key);
+        if (item == _Py_NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_KeyError)) {
+                error = 1;
+                break;
+            }
+            PyErr_Clear();
+        }
+        Py_XDECREF(item);
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (error) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_mapping_getoptionalitem_hit(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_mapping_getoptionalitem(args, 1);
+}
+
+
+static PyObject *
+bench_mapping_getoptionalitem_miss(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_mapping_getoptionalitem(args, 0);
+}
+
+
+static PyObject *
+bench_mapping_getoptionalitem_hit_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_mapping_getoptionalitem_ref(args, 1);
+}
+
+
+static PyObject *
+bench_mapping_getoptionalitem_miss_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_mapping_getoptionalitem_ref(args, 0);
+}
+
+
+#if ((PY_VERSION_HEX <= 0x030B00A1 || 0x030B00A7 <= PY_VERSION_HEX) \
+     && !defined(PYPY_VERSION))
+#define FLOAT_ARRAY_SIZE 1000
+
+// PyCompat_Float_PackArray8() on 1000 values (big endian)
+static PyObject *
+bench_float_pack_array8(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    double data[FLOAT_ARRAY_SIZE];
+    char packed[FLOAT_ARRAY_SIZE * 8];
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    for (i = 0; i < FLOAT_ARRAY_SIZE; i++) {
+        data[i] = (double)i * 0.5;
+    }
+
+    for (i = 0; i < loops; i++) {
+        if (PyCompat_Float_PackArray8(data, packed, FLOAT_ARRAY_SIZE, 0) < 0) {
+            return _Py_NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_float_pack_array8(): call PyFloat_Pack8() on each value
+static PyObject *
+bench_float_pack_array8_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i, j;
+    double data[FLOAT_ARRAY_SIZE];
+    char packed[FLOAT_ARRAY_SIZE * 8];
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    for (i = 0; i < FLOAT_ARRAY_SIZE; i++) {
+        data[i] = (double)i * 0.5;
+    }
+
+    for (i = 0; i < loops; i++) {
+        for (j = 0; j < FLOAT_ARRAY_SIZE; j++) {
+            if (PyFloat_Pack8(data[j], packed + j * 8, 0) < 0) {
+                return _Py_NULL;
+            }
+        }
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+#ifndef PYPY_VERSION
+// PyFrame_GetVar() on the caller frame: bench_func() of
+// bench_pythoncapi_compat.py, which has a "loops" local variable.
+static PyObject *
+bench_frame_getvar(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame;
+    PyObject *name, *value;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = PyEval_GetFrame();
+    if (frame == _Py_NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "no current frame");
+        return _Py_NULL;
+    }
+    name = Py_BuildValue("s", "loops");
+    if (name == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        value = PyFrame_GetVar(frame, name);
+        if (value == _Py_NULL) {
+            Py_DECREF(name);
+            return _Py_NULL;
+        }
+        Py_DECREF(value);
+    }
+    Py_DECREF(name);
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_frame_getvar(): PyFrame_GetLocals() and lookup the
+// variable in the locals dictionary, as PyFrame_GetVar() does without
+// PYTHONCAPI_COMPAT_FAST_LOCALS.
+static PyObject *
+bench_frame_getvar_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame;
+    PyObject *name, *locals, *value;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = PyEval_GetFrame();
+    if (frame == _Py_NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "no current frame");
+        return _Py_NULL;
+    }
+    name = Py_BuildValue("s", "loops");
+    if (name == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        locals = PyFrame_GetLocals(frame);
+        if (locals == _Py_NULL) {
+            Py_DECREF(name);
+            return _Py_NULL;
+        }
+        value = PyObject_GetItem(locals, name);
+        Py_DECREF(locals);
+        if (value == _Py_NULL) {
+            Py_DECREF(name);
+            return _Py_NULL;
+        }
+        Py_DECREF(value);
+    }
+    Py_DECREF(name);
+    Py_RETURN_NONE;
+}
+
+
+// PyCompat_CaptureStack() of the current thread
+static PyObject *
+bench_capture_stack(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyThreadState *tstate = PyThreadState_Get();
+    PyCompat_StackEntry entries[64];
+    int depth;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        depth = PyCompat_CaptureStack(tstate, entries, 64);
+        if (depth <= 0) {
+            PyErr_SetString(PyExc_RuntimeError, "empty stack");
+            return _Py_NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_capture_stack(): walk the stack one frame at a time
+// with PyThreadState_GetFrame(), PyFrame_GetBack(), PyFrame_GetCode() and
+// PyFrame_GetLasti().
+static PyObject *
+bench_capture_stack_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyThreadState *tstate = PyThreadState_Get();
+    PyCompat_StackEntry entries[64];
+    PyFrameObject *frame, *back;
+    PyCodeObject *code;
+    int depth;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        depth = 0;
+        frame = PyThreadState_GetFrame(tstate);
+        while (frame != _Py_NULL && depth < 64) {
+            code = PyFrame_GetCode(frame);
+            entries[depth].code = code;
+            Py_DECREF(code);
+            entries[depth].lasti = PyFrame_GetLasti(frame);
+            depth++;
+            back = PyFrame_GetBack(frame);
+            Py_DECREF(frame);
+            frame = back;
+        }
+        Py_XDECREF(frame);
+        if (depth <= 0 || entries[0].code == _Py_NULL) {
+            PyErr_SetString(PyExc_RuntimeError, "empty stack");
+            return _Py_NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Get the code object and the last instruction of the caller frame
+static int
+get_frame_code_lasti(PyCodeObject **code, int *lasti)
+{
+    PyFrameObject *frame = PyEval_GetFrame();
+    if (frame == _Py_NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "no current frame");
+        return -1;
+    }
+    *code = _PyFrame_GetCodeBorrow(frame);
+    *lasti = PyFrame_GetLasti(frame);
+    return 0;
+}
+
+
+// PyCompat_Code_Addr2Line() on the caller frame
+static PyObject *
+bench_code_addr2line(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyCodeObject *code;
+    int lasti;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    if (get_frame_code_lasti(&code, &lasti) < 0) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        if (PyCompat_Code_Addr2Line(code, lasti) < 0) {
+            PyErr_SetString(PyExc_RuntimeError, "no line number");
+            return _Py_NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_code_addr2line(): PyCode_Addr2Line() decodes the line
+// table at each call.
+static PyObject *
+bench_code_addr2line_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyCodeObject *code;
+    int lasti;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    if (get_frame_code_lasti(&code, &lasti) < 0) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        if (PyCode_Addr2Line(code, lasti) < 0) {
+            PyErr_SetString(PyExc_RuntimeError, "no line number");
+            return _Py_NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+
+// PyCompat_Code_GetVarnames() on the caller frame code
+static PyObject *
+bench_code_getvarnames(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyCodeObject *code;
+    PyObject *varnames;
+    int lasti;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    if (get_frame_code_lasti(&code, &lasti) < 0) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        varnames = PyCompat_Code_GetVarnames(code);
+        if (varnames == _Py_NULL) {
+            return _Py_NULL;
+        }
+        Py_DECREF(varnames);
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_code_getvarnames(): PyCode_GetVarnames() creates a new
+// tuple at each call on Python 3.11.
+static PyObject *
+bench_code_getvarnames_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyCodeObject *code;
+    PyObject *varnames;
+    int lasti;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    if (get_frame_code_lasti(&code, &lasti) < 0) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        varnames = PyCode_GetVarnames(code);
+        if (varnames == _Py_NULL) {
+            return _Py_NULL;
+        }
+        Py_DECREF(varnames);
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+// Py_NewRef()
+static PyObject *
+bench_newref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *ref;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = PyList_New(0);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        ref = Py_NewRef(obj);
+        Py_DECREF(ref);
+    }
+    Py_DECREF(obj);
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_newref(): Py_INCREF()
+static PyObject *
+bench_newref_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = PyList_New(0);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        Py_INCREF(obj);
+        Py_DECREF(obj);
+    }
+    Py_DECREF(obj);
+    Py_RETURN_NONE;
+}
+
+
+// PyDict_GetItemRef() with an existing key
+static PyObject *
+bench_dict_getitemref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *item;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        res = PyDict_GetItemRef(dict, key, &item);
+        if (res < 0) {
+            break;
+        }
+        Py_XDECREF(item);
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_dict_getitemref(): PyDict_GetItemWithError() and
+// Py_INCREF()
+static PyObject *
+bench_dict_getitemref_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *item;
+    int error = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+#ifdef PYTHON3
+        item = PyDict_GetItemWithError(dict, key);
+#else
+        item = _PyDict_GetItemWithError(dict, key);
+#endif
+        if (item == _Py_NULL) {
+            error = 1;
+            break;
+        }
+        Py_INCREF(item);
+        Py_DECREF(item);
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (error) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_KeyError, "key");
+        }
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Lookup-then-insert pattern of a cache with PyDict_SetDefaultRef(): the key
+// is present (hit) or missing (miss). On a miss, the inserted key is removed
+// to start the next iteration with the same dict.
+static PyObject *
+bench_dict_setdefaultref(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *lookup_key, *item;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_key = (hit ? key : missing_key);
+
+    for (i = 0; i < loops; i++) {
+        res = PyDict_SetDefaultRef(dict, lookup_key, Py_None, &item);
+        if (res < 0) {
+            break;
+        }
+        Py_DECREF(item);
+        if (res == 0 && PyDict_DelItem(dict, lookup_key) < 0) {
+            res = -1;
+            break;
+        }
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_dict_setdefaultref(): PyDict_GetItemRef() and then
+// PyDict_SetItem() if the key is missing, two lookups on a miss
+static PyObject *
+bench_dict_getitemref_setitem(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *dict, *key, *missing_key, *lookup_key, *item;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    dict = create_dict_with_key(&key, &missing_key);
+    if (dict == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_key = (hit ? key : missing_key);
+
+    for (i = 0; i < loops; i++) {
+        res = PyDict_GetItemRef(dict, lookup_key, &item);
+        if (res < 0) {
+            break;
+        }
+        if (res == 0) {
+            if (PyDict_SetItem(dict, lookup_key, Py_None) < 0) {
+                res = -1;
+                break;
+            }
+            item = Py_NewRef(Py_None);
+        }
+        Py_DECREF(item);
+        if (res == 0 && PyDict_DelItem(dict, lookup_key) < 0) {
+            res = -1;
+            break;
+        }
+    }
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(missing_key);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_dict_setdefaultref_hit(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_dict_setdefaultref(args, 1);
+}
+
+
+static PyObject *
+bench_dict_setdefaultref_miss(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_dict_setdefaultref(args, 0);
+}
+
+
+static PyObject *
+bench_dict_setdefaultref_hit_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_dict_getitemref_setitem(args, 1);
+}
+
+
+static PyObject *
+bench_dict_setdefaultref_miss_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_dict_getitemref_setitem(args, 0);
+}
+
+
+// Create an instance of a class with a class attribute "attr"
+static PyObject*
+create_object_with_attr(PyObject **name, PyObject **missing_name)
+{
+    PyObject *obj = create_py_func("type('C', (object,), {'attr': 1})()");
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    *name = Py_BuildValue("s", "attr");
+    *missing_name = Py_BuildValue("s", "missing_attr");
+    if (*name == _Py_NULL || *missing_name == _Py_NULL) {
+        Py_DECREF(obj);
+        Py_XDECREF(*name);
+        Py_XDECREF(*missing_name);
+        return _Py_NULL;
+    }
+    return obj;
+}
+
+
+static PyObject *
+bench_getoptionalattr(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *name, *missing_name, *lookup_name, *value;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = create_object_with_attr(&name, &missing_name);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_name = (hit ? name : missing_name);
+
+    for (i = 0; i < loops; i++) {
+        res = PyObject_GetOptionalAttr(obj, lookup_name, &value);
+        if (res < 0) {
+            break;
+        }
+        Py_XDECREF(value);
+    }
+    Py_DECREF(obj);
+    Py_DECREF(name);
+    Py_DECREF(missing_name);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_getoptionalattr(): PyObject_GetAttr() and clear
+// AttributeError if the attribute is missing
+static PyObject *
+bench_getattr(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *name, *missing_name, *lookup_name, *value;
+    int error = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = create_object_with_attr(&name, &missing_name);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_name = (hit ? name : missing_name);
+
+    for (i = 0; i < loops; i++) {
+        value = PyObject_GetAttr(obj, lookup_name);
+        if (value == _Py_NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                error = 1;
+                break;
+            }
+            PyErr_Clear();
+        }
+        Py_XDECREF(value);
+    }
+    Py_DECREF(obj);
+    Py_DECREF(name);
+    Py_DECREF(missing_name);
+    if (error) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_getoptionalattr_hit(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getoptionalattr(args, 1);
+}
+
+
+static PyObject *
+bench_getoptionalattr_miss(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getoptionalattr(args, 0);
+}
+
+
+static PyObject *
+bench_getoptionalattr_hit_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getattr(args, 1);
+}
+
+
+static PyObject *
+bench_getoptionalattr_miss_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getattr(args, 0);
+}
+
+
+// PyObject_HasAttrWithError() with an existing (hit) or missing (miss)
+// attribute
+static PyObject *
+bench_hasattrwitherror(PyObject *args, int hit)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *name, *missing_name, *lookup_name;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = create_object_with_attr(&name, &missing_name);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    lookup_name = (hit ? name : missing_name);
+
+    for (i = 0; i < loops; i++) {
+        res = PyObject_HasAttrWithError(obj, lookup_name);
+        if (res < 0) {
+            break;
+        }
+    }
+    Py_DECREF(obj);
+    Py_DECREF(name);
+    Py_DECREF(missing_name);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// The reference of bench_hasattrwitherror() is bench_getattr()
+static PyObject *
+bench_hasattrwitherror_hit(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_hasattrwitherror(args, 1);
+}
+
+
+static PyObject *
+bench_hasattrwitherror_miss(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_hasattrwitherror(args, 0);
+}
+
+
+static PyObject *
+bench_hasattrwitherror_hit_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getattr(args, 1);
+}
+
+
+static PyObject *
+bench_hasattrwitherror_miss_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    return bench_getattr(args, 0);
+}
+
+
+// gh-105927 deprecated PyWeakref_GetObject() in Python 3.13.0a1: on Python
+// 3.13 and newer, PyWeakref_GetRef() has no reference to compare to.
+#if PY_VERSION_HEX < 0x030D00A1
+// PyWeakref_GetRef() on a live object
+static PyObject *
+bench_weakref_getref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *wr, *ref;
+    int res = 0;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = create_py_func("lambda: None");
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    wr = PyWeakref_NewRef(obj, _Py_NULL);
+    if (wr == _Py_NULL) {
+        Py_DECREF(obj);
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        res = PyWeakref_GetRef(wr, &ref);
+        if (res <= 0) {
+            break;
+        }
+        Py_DECREF(ref);
+    }
+    Py_DECREF(wr);
+    Py_DECREF(obj);
+    if (res < 0) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// Reference for bench_weakref_getref(): PyWeakref_GetObject() and
+// Py_INCREF()
+static PyObject *
+bench_weakref_getref_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyObject *obj, *wr, *ref;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    obj = create_py_func("lambda: None");
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+    wr = PyWeakref_NewRef(obj, _Py_NULL);
+    if (wr == _Py_NULL) {
+        Py_DECREF(obj);
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        ref = PyWeakref_GetObject(wr);
+        if (ref == _Py_NULL) {
+            break;
+        }
+        Py_INCREF(ref);
+        Py_DECREF(ref);
+    }
+    Py_DECREF(wr);
+    Py_DECREF(obj);
+    if (PyErr_Occurred()) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+// On Python 3.11 and newer, frame structure members are no longer accessible:
+// PyFrame_GetCode(), PyFrame_GetBack() and PyThreadState_GetFrame() have no
+// reference to compare to.
+#if !defined(PYPY_VERSION) && PY_VERSION_HEX < 0x030B0000
+static PyFrameObject*
+get_frame(void)
+{
+    PyFrameObject *frame = PyEval_GetFrame();
+    if (frame == _Py_NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "no current frame");
+    }
+    return frame;
+}
+
+
+// PyFrame_GetCode() on the caller frame
+static PyObject *
+bench_frame_getcode(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame;
+    PyCodeObject *code;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = get_frame();
+    if (frame == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        code = PyFrame_GetCode(frame);
+        Py_DECREF(code);
+    }
+    Py_RETURN_NONE;
+}
+
+
+// PyFrame_GetBack() on the caller frame
+static PyObject *
+bench_frame_getback(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame, *back;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = get_frame();
+    if (frame == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        back = PyFrame_GetBack(frame);
+        Py_XDECREF(back);
+    }
+    Py_RETURN_NONE;
+}
+
+
+// PyThreadState_GetFrame() of the current thread
+static PyObject *
+bench_threadstate_getframe(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyThreadState *tstate = PyThreadState_Get();
+    PyFrameObject *frame;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        frame = PyThreadState_GetFrame(tstate);
+        Py_XDECREF(frame);
+    }
+    Py_RETURN_NONE;
+}
+
+
+// References for bench_frame_getcode(), bench_frame_getback() and
+// bench_threadstate_getframe(): read the structure member and Py_INCREF()
+static PyObject *
+bench_frame_getcode_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame;
+    PyCodeObject *code;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = get_frame();
+    if (frame == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        code = frame->f_code;
+        Py_INCREF(code);
+        Py_DECREF(code);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_frame_getback_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyFrameObject *frame, *back;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    frame = get_frame();
+    if (frame == _Py_NULL) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        back = frame->f_back;
+        Py_XINCREF(back);
+        Py_XDECREF(back);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_threadstate_getframe_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyThreadState *tstate = PyThreadState_Get();
+    PyFrameObject *frame;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        frame = tstate->frame;
+        Py_XINCREF(frame);
+        Py_XDECREF(frame);
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+// PyMutex requires atomic operations on Python 3.12 and older
+#if (PY_VERSION_HEX >= 0x030D00B3 || defined(__ATOMIC_ACQUIRE) \
+     || defined(_MSC_VER))
+#define HAVE_PYMUTEX
+
+static PyObject *
+bench_mutex(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyMutex mutex = {0};
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+
+    for (i = 0; i < loops; i++) {
+        PyMutex_Lock(&mutex);
+        PyMutex_Unlock(&mutex);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+bench_mutex_ref(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    Py_ssize_t loops, i;
+    PyThread_type_lock lock;
+
+    if (!parse_loops(args, &loops)) {
+        return _Py_NULL;
+    }
+    lock = PyThread_allocate_lock();
+    if (lock == _Py_NULL) {
+        return PyErr_NoMemory();
+    }
+
+    for (i = 0; i < loops; i++) {
+        (void)PyThread_acquire_lock(lock, WAIT_LOCK);
+        PyThread_release_lock(lock);
+    }
+    PyThread_free_lock(lock);
+    Py_RETURN_NONE;
+}
+
+
+typedef struct {
+    Py_ssize_t loops;
+    int nthreads;
+    // Lock of the reference benchmark, or NULL to use mutex
+    PyThread_type_lock ref_lock;
+    PyMutex mutex;
+    Py_ssize_t counter;
+    // Held by the main thread until all threads are started
+    PyThread_type_lock start;
+    // Protected by mutex
+    int finished;
+    // Released by the last thread
+    PyThread_type_lock done;
+} contention_data;
+
+
+// Thread without Python thread state: don't use the Python C API
+static void
+contention_thread(void *arg)
+{
+    contention_data *data = (contention_data*)arg;
+    Py_ssize_t i;
+    int last;
+
+    (void)PyThread_acquire_lock(data->start, WAIT_LOCK);
+    PyThread_release_lock(data->start);
+
+    if (data->ref_lock != _Py_NULL) {
+        for (i = 0; i < data->loops; i++) {
+            (void)PyThread_acquire_lock(data->ref_lock, WAIT_LOCK);
+            data->counter++;
+            PyThread_release_lock(data->ref_lock);
+        }
+    }
+    else {
+        for (i = 0; i < data->loops; i++) {
+            PyMutex_Lock(&data->mutex);
+            data->counter++;
+            PyMutex_Unlock(&data->mutex);
+        }
+    }
+
+    PyMutex_Lock(&data->mutex);
+    data->finished++;
+    last = (data->finished == data->nthreads);
+    PyMutex_Unlock(&data->mutex);
+    // data can be destroyed as soon as done is released
+    if (last) {
+        PyThread_release_lock(data->done);
+    }
+}
+
+
+static PyObject *
+mutex_contention(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    contention_data data;
+    int ref, started;
+
+    memset(&data, 0, sizeof(data));
+    if (!PyArg_ParseTuple(args, "ini", &data.nthreads, &data.loops, &ref)) {
+        return _Py_NULL;
+    }
+    if (data.nthreads < 1) {
+        PyErr_SetString(PyExc_ValueError, "nthreads must be positive");
+        return _Py_NULL;
+    }
+
+    data.start = PyThread_allocate_lock();
+    data.done = PyThread_allocate_lock();
+    if (ref) {
+        data.ref_lock = PyThread_allocate_lock();
+    }
+    if (data.start == _Py_NULL || data.done == _Py_NULL
+        || (ref && data.ref_lock == _Py_NULL))
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+    (void)PyThread_acquire_lock(data.start, WAIT_LOCK);
+    (void)PyThread_acquire_lock(data.done, WAIT_LOCK);
+
+    for (started = 0; started < data.nthreads; started++) {
+        long thread_id = (long)PyThread_start_new_thread(contention_thread,
+                                                         &data);
+        if (thread_id == -1) {
+            PyErr_SetString(PyExc_RuntimeError, "failed to start a thread");
+            break;
+        }
+    }
+    // Started threads wait for the start lock: only wait for them
+    data.nthreads = started;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_release_lock(data.start);
+    if (started) {
+        (void)PyThread_acquire_lock(data.done, WAIT_LOCK);
+    }
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(data.done);
+
+done:
+    if (data.ref_lock != _Py_NULL) {
+        PyThread_free_lock(data.ref_lock);
+    }
+    if (data.done != _Py_NULL) {
+        PyThread_free_lock(data.done);
+    }
+    if (data.start != _Py_NULL) {
+        PyThread_free_lock(data.start);
+    }
+    if (PyErr_Occurred()) {
+        return _Py_NULL;
+    }
+    Py_RETURN_NONE;
+}
+#endif
+
+
+#ifdef HAVE_PERF_EVENT
+static int
+perf_event_open_hw(__u64 config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    // The group leader starts disabled
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+// perf_counters(func, loops): call func(loops) and return the number of
+// user-space instructions and branches as a tuple. Raise OSError if perf
+// counters are not available.
+static PyObject *
+perf_counters(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    PyObject *func, *res;
+    Py_ssize_t loops;
+    int leader, fd, err;
+    ssize_t n;
+    struct {
+        __u64 nr;
+        __u64 values[2];
+    } data;
+
+    if (!PyArg_ParseTuple(args, "On", &func, &loops)) {
+        return _Py_NULL;
+    }
+
+    leader = perf_event_open_hw(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    if (leader < 0) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    fd = perf_event_open_hw(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, leader);
+    if (fd < 0) {
+        err = errno;
+        close(leader);
+        errno = err;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    res = PyObject_CallFunction(func, "n", loops);
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    n = read(leader, &data, sizeof(data));
+    err = errno;
+    close(fd);
+    close(leader);
+
+    if (res == _Py_NULL) {
+        return _Py_NULL;
+    }
+    Py_DECREF(res);
+    if (n != (ssize_t)sizeof(data) || data.nr != 2) {
+        errno = err;
+        if (n < 0) {
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        PyErr_SetString(PyExc_OSError, "failed to read perf counters");
+        return _Py_NULL;
+    }
+    return Py_BuildValue("(KK)", (unsigned PY_LONG_LONG)data.values[0],
+                         (unsigned PY_LONG_LONG)data.values[1]);
+}
+#endif
+
+
+static struct PyMethodDef methods[] = {
+    {"bench_newref", bench_newref, METH_VARARGS, _Py_NULL},
+    {"bench_newref_ref", bench_newref_ref, METH_VARARGS, _Py_NULL},
+    {"bench_dict_getitemref", bench_dict_getitemref, METH_VARARGS, _Py_NULL},
+    {"bench_dict_getitemref_ref", bench_dict_getitemref_ref, METH_VARARGS, _Py_NULL},
+    {"bench_dict_setdefaultref_hit", bench_dict_setdefaultref_hit, METH_VARARGS, _Py_NULL},
+    {"bench_dict_setdefaultref_hit_ref", bench_dict_setdefaultref_hit_ref, METH_VARARGS, _Py_NULL},
+    {"bench_dict_setdefaultref_miss", bench_dict_setdefaultref_miss, METH_VARARGS, _Py_NULL},
+    {"bench_dict_setdefaultref_miss_ref", bench_dict_setdefaultref_miss_ref, METH_VARARGS, _Py_NULL},
+    {"bench_getoptionalattr_hit", bench_getoptionalattr_hit, METH_VARARGS, _Py_NULL},
+    {"bench_getoptionalattr_hit_ref", bench_getoptionalattr_hit_ref, METH_VARARGS, _Py_NULL},
+    {"bench_getoptionalattr_miss", bench_getoptionalattr_miss, METH_VARARGS, _Py_NULL},
+    {"bench_getoptionalattr_miss_ref", bench_getoptionalattr_miss_ref, METH_VARARGS, _Py_NULL},
+    {"bench_hasattrwitherror_hit", bench_hasattrwitherror_hit, METH_VARARGS, _Py_NULL},
+    {"bench_hasattrwitherror_hit_ref", bench_hasattrwitherror_hit_ref, METH_VARARGS, _Py_NULL},
+    {"bench_hasattrwitherror_miss", bench_hasattrwitherror_miss, METH_VARARGS, _Py_NULL},
+    {"bench_hasattrwitherror_miss_ref", bench_hasattrwitherror_miss_ref, METH_VARARGS, _Py_NULL},
+#if PY_VERSION_HEX < 0x030D00A1
+    {"bench_weakref_getref", bench_weakref_getref, METH_VARARGS, _Py_NULL},
+    {"bench_weakref_getref_ref", bench_weakref_getref_ref, METH_VARARGS, _Py_NULL},
+#endif
+    {"bench_vectorcall", bench_vectorcall, METH_VARARGS, _Py_NULL},
+    {"bench_vectorcall_ref", bench_vectorcall_ref, METH_VARARGS, _Py_NULL},
+    {"bench_vectorcall_kwnames", bench_vectorcall_kwnames, METH_VARARGS, _Py_NULL},
+    {"bench_vectorcall_kwnames_ref", bench_vectorcall_kwnames_ref, METH_VARARGS, _Py_NULL},
+    {"bench_mapping_getoptionalitem_hit", bench_mapping_getoptionalitem_hit, METH_VARARGS, _Py_NULL},
+    {"bench_mapping_getoptionalitem_miss", bench_mapping_getoptionalitem_miss, METH_VARARGS, _Py_NULL},
+    {"bench_mapping_getoptionalitem_hit_ref", bench_mapping_getoptionalitem_hit_ref, METH_VARARGS, _Py_NULL},
+    {"bench_mapping_getoptionalitem_miss_ref", bench_mapping_getoptionalitem_miss_ref, METH_VARARGS, _Py_NULL},
+#if !defined(PYPY_VERSION) && PY_VERSION_HEX < 0x030B0000
+    {"bench_frame_getcode", bench_frame_getcode, METH_VARARGS, _Py_NULL},
+    {"bench_frame_getback", bench_frame_getback, METH_VARARGS, _Py_NULL},
+    {"bench_threadstate_getframe", bench_threadstate_getframe, METH_VARARGS, _Py_NULL},
+    {"bench_frame_getcode_ref", bench_frame_getcode_ref, METH_VARARGS, _Py_NULL},
+    {"bench_frame_getback_ref", bench_frame_getback_ref, METH_VARARGS, _Py_NULL},
+    {"bench_threadstate_getframe_ref", bench_threadstate_getframe_ref, METH_VARARGS, _Py_NULL},
+#endif
+#ifndef PYPY_VERSION
+    {"bench_frame_getvar", bench_frame_getvar, METH_VARARGS, _Py_NULL},
+    {"bench_frame_getvar_ref", bench_frame_getvar_ref, METH_VARARGS, _Py_NULL},
+    {"bench_capture_stack", bench_capture_stack, METH_VARARGS, _Py_NULL},
+    {"bench_capture_stack_ref", bench_capture_stack_ref, METH_VARARGS, _Py_NULL},
+    {"bench_code_addr2line", bench_code_addr2line, METH_VARARGS, _Py_NULL},
+    {"bench_code_addr2line_ref", bench_code_addr2line_ref, METH_VARARGS, _Py_NULL},
+    {"bench_code_getvarnames", bench_code_getvarnames, METH_VARARGS, _Py_NULL},
+    {"bench_code_getvarnames_ref", bench_code_getvarnames_ref, METH_VARARGS, _Py_NULL},
+#endif
+#if ((PY_VERSION_HEX <= 0x030B00A1 || 0x030B00A7 <= PY_VERSION_HEX) \
+     && !defined(PYPY_VERSION))
+    {"bench_float_pack_array8", bench_float_pack_array8, METH_VARARGS, _Py_NULL},
+    {"bench_float_pack_array8_ref", bench_float_pack_array8_ref, METH_VARARGS, _Py_NULL},
+#endif
+#ifdef HAVE_PYMUTEX
+    {"bench_mutex", bench_mutex, METH_VARARGS, _Py_NULL},
+    {"bench_mutex_ref", bench_mutex_ref, METH_VARARGS, _Py_NULL},
+    {"mutex_contention", mutex_contention, METH_VARARGS, _Py_NULL},
+#endif
+#ifdef HAVE_PERF_EVENT
+    {"perf_counters", perf_counters, METH_VARARGS, _Py_NULL},
+#endif
+    {_Py_NULL, _Py_NULL, 0, _Py_NULL}
+};
+
+
+#ifdef PYTHON3
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    MODULE_NAME_STR,     // m_name
+    _Py_NULL,            // m_doc
+    0,                   // m_size
+    methods,             // m_methods
+    _Py_NULL,            // m_slots
+    _Py_NULL,            // m_traverse
+    _Py_NULL,            // m_clear
+    _Py_NULL,            // m_free
+};
+
+
+PyMODINIT_FUNC
+CONCAT(PyInit_, MODULE_NAME)(void)
+{
+    PyObject *module = PyModule_Create(&module_def);
+    if (module == _Py_NULL) {
+        return _Py_NULL;
+    }
+    // Don't enable the GIL in free-threaded builds
+    if (PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED) < 0) {
+        Py_DECREF(module);
+        return _Py_NULL;
+    }
+    return module;
+}
+
+#else
+// Python 2
+
+PyMODINIT_FUNC
+CONCAT(init, MODULE_NAME)(void)
+{
+    Py_InitModule4(MODULE_NAME_STR,
+                   methods,
+                   _Py_NULL,
+                   _Py_NULL,
+                   PYTHON_API_VERSION);
+}
+#endif
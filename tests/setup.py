@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import os.path
 import sys
+import sysconfig
 
 
 # C++ is only supported on Python 3.6 and newer
@@ -15,6 +16,9 @@ SRC_DIR = os.path.normpath(os.path.join(os.path.dirname(__file__), '..'))
 # Windows uses MSVC compiler
 MSVC = (os.name == "nt")
 
+# Free-threaded build (Python 3.13 built with --disable-gil)
+FREE_THREADING = bool(sysconfig.get_config_var('Py_GIL_DISABLED'))
+
 # C compiler flags for GCC and clang
 COMMON_FLAGS = [
     # Treat warnings as error
@@ -41,6 +45,41 @@ if 0:
         '-Wzero-as-null-pointer-constant',
     ))
 
+# Macros enabling opt-in optimizations of pythoncapi_compat.h,
+# tested by the test_pythoncapi_compat_optext extension
+OPTIN_MACROS = [
+    ('MODULE_NAME', 'test_pythoncapi_compat_optext'),
+    ('PYTHONCAPI_COMPAT_STRING_CACHE', None),
+    ('PYTHONCAPI_COMPAT_FAST_LOCALS', None),
+    ('PYTHONCAPI_COMPAT_STATS', None),
+]
+
+
+def cpp_flag_supported(flag):
+    # Check if the C++ compiler accepts a -std flag by building an empty file:
+    # old GCC and clang versions don't support -std=c++17 or -std=c++20.
+    import shutil
+    import tempfile
+    from distutils.ccompiler import new_compiler
+    from distutils.errors import CompileError
+    from distutils.sysconfig import customize_compiler
+
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    tmpdir = tempfile.mkdtemp()
+    try:
+        filename = os.path.join(tmpdir, 'empty.cpp')
+        with open(filename, 'w') as fp:
+            fp.write('int main(void) { return 0; }\n')
+        try:
+            compiler.compile([filename], output_dir=tmpdir,
+                             extra_postargs=[flag])
+        except CompileError:
+            return False
+        return True
+    finally:
+        shutil.rmtree(tmpdir)
+
 
 def main():
     try:
@@ -53,6 +92,11 @@ def main():
     if not MSVC:
         cflags.extend(CFLAGS)
         cppflags.extend(CPPFLAGS)
+    elif FREE_THREADING:
+        # On Windows, pyconfig.h doesn't define Py_GIL_DISABLED: it must be
+        # defined by the build system of C extensions
+        cflags.append('/DPy_GIL_DISABLED=1')
+        cppflags.append('/DPy_GIL_DISABLED=1')
 
     # C extension
     c_ext = Extension(
@@ -61,6 +105,21 @@ def main():
         extra_compile_args=cflags)
     extensions = [c_ext]
 
+    # C extension with opt-in optimizations
+    opt_ext = Extension(
+        'test_pythoncapi_compat_optext',
+        sources=['test_pythoncapi_compat_cext.c'],
+        define_macros=OPTIN_MACROS,
+        extra_compile_args=cflags)
+    extensions.append(opt_ext)
+
+    # C extension running micro-benchmarks
+    bench_ext = Extension(
+        'bench_pythoncapi_compat_cext',
+        sources=['bench_pythoncapi_compat_cext.c'],
+        extra_compile_args=cflags)
+    extensions.append(bench_ext)
+
     if TEST_CPP:
         # C++ extension
 
@@ -69,12 +128,18 @@ def main():
             versions = [
                 ('test_pythoncapi_compat_cpp03ext', '-std=c++03'),
                 ('test_pythoncapi_compat_cpp11ext', '-std=c++11'),
+                ('test_pythoncapi_compat_cpp17ext', '-std=c++17'),
+                ('test_pythoncapi_compat_cpp20ext', '-std=c++20'),
             ]
         else:
             versions = [('test_pythoncapi_compat_cppext', None)]
         for name, flag in versions:
             flags = list(cppflags)
             if flag is not None:
+                if not cpp_flag_supported(flag):
+                    print("Skip %s: compiler doesn't support %s"
+                          % (name, flag))
+                    continue
                 flags.append(flag)
             cpp_ext = Extension(
                 name,
@@ -0,0 +1,329 @@
+#!/usr/bin/env python3
+"""
+Check the machine code generated for pythoncapi_compat.h functions.
+
+Compile probe functions with the C compiler and disassemble them with objdump:
+a function of pythoncapi_compat.h must compile to the same instructions as
+the hand-written code accessing the structure member.
+
+C++ probes check that the pythoncapi_compat.hpp reference types compile to
+the same instructions as the code using raw PyObject* pointers.
+
+Shim probes check that small functions like Py_NewRef() or Py_IsNone() are
+inlined and compile to the same instructions as the hand-written code, in C,
+C++03 and C++11, with GCC and clang. If the CC environment variable is set,
+only test the CC and CXX compilers.
+
+The test is skipped if the C compiler or objdump is missing.
+
+Usage::
+
+    python3 test_codegen.py
+    python3 test_codegen.py -v # verbose mode
+"""
+from __future__ import absolute_import
+from __future__ import print_function
+import os.path
+import platform
+import re
+import shlex
+import shutil
+import subprocess
+import sys
+import sysconfig
+import tempfile
+import unittest
+try:
+    from shutil import which
+except ImportError:
+    # Python 2
+    from distutils.spawn import find_executable as which
+
+
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+SRC_DIR = os.path.dirname(TEST_DIR)
+PYPY = (platform.python_implementation() == 'PyPy')
+
+# C++ standards of C++ probes
+CXX_STANDARDS = ('c++11', 'c++17', 'c++20')
+
+# Languages of shim probes: (name, C++?, compiler flags)
+SHIM_LANGUAGES = (
+    ('C', False, ['-std=c99']),
+    ('C++03', True, ['-std=c++03']),
+    ('C++11', True, ['-std=c++11']),
+)
+
+# Compiler families of shim probes: (name, C compiler, C++ compiler)
+COMPILER_FAMILIES = (
+    ('gcc', 'gcc', 'g++'),
+    ('clang', 'clang', 'clang++'),
+)
+
+CFLAGS = ['-O2', '-DNDEBUG', '-fPIC', '-fno-asynchronous-unwind-tables']
+
+# Lines of "objdump -d" output: function header and instruction
+FUNC_REGEX = re.compile(r'^[0-9a-f]+ <([^>]+)>:$')
+INSTR_REGEX = re.compile(r'^ *[0-9a-f]+:\s+(.*)$')
+# Jump target: "1c <probe_ref+0xc>"
+TARGET_REGEX = re.compile(r'[0-9a-f]+ <[^>+]+(\+0x[0-9a-f]+)?>')
+
+
+def get_compiler(cplusplus=False):
+    if cplusplus:
+        compiler = (os.environ.get('CXX') or sysconfig.get_config_var('CXX')
+                    or 'c++')
+    else:
+        compiler = (os.environ.get('CC') or sysconfig.get_config_var('CC')
+                    or 'cc')
+    cmd = shlex.split(compiler)
+    if not which(cmd[0]):
+        return None
+    return cmd
+
+
+def get_compilers():
+    # Return a list of (name, C compiler, C++ compiler) tuples
+    if os.environ.get('CC'):
+        return [('CC', get_compiler(), get_compiler(cplusplus=True))]
+    compilers = []
+    for name, cc, cxx in COMPILER_FAMILIES:
+        if which(cc):
+            compilers.append((name, [cc], [cxx] if which(cxx) else None))
+    if not compilers:
+        compilers.append(('cc', get_compiler(), get_compiler(cplusplus=True)))
+    return compilers
+
+
+def disassemble(compiler, objdump, source, tmpdir, cplusplus=False):
+    c_filename = os.path.join(tmpdir, 'probe.cpp' if cplusplus else 'probe.c')
+    obj_filename = os.path.join(tmpdir, 'probe.o')
+    with open(c_filename, 'w') as fp:
+        fp.write(source)
+
+    include_dir = sysconfig.get_paths()['include']
+    cmd = compiler + CFLAGS + ['-I', SRC_DIR, '-I', include_dir,
+                               '-c', c_filename, '-o', obj_filename]
+    subprocess.check_call(cmd)
+
+    cmd = [objdump, '-d', '--no-show-raw-insn', obj_filename]
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                            universal_newlines=True)
+    stdout = proc.communicate()[0]
+    if proc.returncode:
+        raise Exception("%s failed with exit code %s"
+                        % (cmd, proc.returncode))
+    return parse_objdump(stdout)
+
+
+def parse_objdump(output):
+    # Return a dict: function name => list of instructions
+    funcs = {}
+    instructions = None
+    for line in output.splitlines():
+        match = FUNC_REGEX.match(line)
+        if match:
+            instructions = funcs[match.group(1)] = []
+            continue
+        if instructions is None:
+            continue
+        match = INSTR_REGEX.match(line)
+        if match:
+            # Ignore the comment of RIP relative addresses
+            instr = match.group(1).split('#')[0]
+            instr = ' '.join(instr.split())
+            # Only keep the offset of jump targets in the function
+            instr = TARGET_REGEX.sub(lambda m: '<%s>' % (m.group(1) or '+0'),
+                                     instr)
+            # Ignore padding
+            if instr.startswith(('nop', 'xchg %ax,%ax', 'data16')):
+                continue
+            instructions.append(instr)
+        elif not line:
+            instructions = None
+    return funcs
+
+
+class CodegenTests(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.compiler = get_compiler()
+        cls.cxx_compiler = get_compiler(cplusplus=True)
+        cls.compilers = get_compilers()
+        cls.objdump = which('objdump')
+
+    def setUp(self):
+        if self.compiler is None:
+            self.skipTest("C compiler not found")
+        if self.objdump is None:
+            self.skipTest("objdump not found")
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def compare_probes(self, funcs, compat_expr):
+        compat = funcs['probe_compat']
+        ref = funcs['probe_ref']
+        if VERBOSE:
+            print()
+            print("%s: %s" % (compat_expr, '; '.join(compat)))
+
+        for instr in compat:
+            self.assertFalse(instr.startswith(('call', 'bl ')),
+                             "%s calls a function: %s" % (compat_expr, instr))
+        self.assertEqual(len(compat), len(ref), compat)
+        self.assertEqual(compat, ref)
+
+    def check_probe(self, rettype, params, compat_expr, ref_expr):
+        # Compile compat_expr and ref_expr in two functions and check that
+        # they compile to the same instructions, without function call.
+        source = ('#include "pythoncapi_compat.h"\n'
+                  '\n'
+                  '%s probe_compat(%s) { return %s; }\n'
+                  '%s probe_ref(%s) { return %s; }\n'
+                  % (rettype, params, compat_expr,
+                     rettype, params, ref_expr))
+        funcs = disassemble(self.compiler, self.objdump, source, self.tmpdir)
+        self.compare_probes(funcs, compat_expr)
+
+    def check_cxx_probe(self, rettype, params, compat_body, ref_body):
+        # Similar to check_probe() but compile C++ function bodies using
+        # pythoncapi_compat.hpp, in each C++ standard
+        if self.cxx_compiler is None:
+            self.skipTest("C++ compiler not found")
+        source = ('#include "pythoncapi_compat.hpp"\n'
+                  '#include <utility>\n'
+                  '\n'
+                  'extern "C" %s probe_compat(%s) { %s }\n'
+                  'extern "C" %s probe_ref(%s) { %s }\n'
+                  % (rettype, params, compat_body,
+                     rettype, params, ref_body))
+        for std in CXX_STANDARDS:
+            compiler = self.cxx_compiler + ['-std=%s' % std]
+            funcs = disassemble(compiler, self.objdump, source, self.tmpdir,
+                                cplusplus=True)
+            self.compare_probes(funcs, '%s: %s' % (std, compat_body))
+
+    def check_shim_probe(self, rettype, params, compat_body, ref_body):
+        # Similar to check_probe() but compile C function bodies with each
+        # compiler family in C, C++03 and C++11
+        source = ('#include "pythoncapi_compat.h"\n'
+                  '\n'
+                  'EXTERN_C %s probe_compat(%s) { %s }\n'
+                  'EXTERN_C %s probe_ref(%s) { %s }\n'
+                  % (rettype, params, compat_body,
+                     rettype, params, ref_body))
+        for name, cc, cxx in self.compilers:
+            for lang, cplusplus, flags in SHIM_LANGUAGES:
+                if cplusplus:
+                    # The Python headers only support C++ on Python 3.6
+                    # and newer
+                    if cxx is None or sys.version_info < (3, 6):
+                        continue
+                    compiler = cxx + flags + ['-DEXTERN_C=extern "C"']
+                else:
+                    if cc is None:
+                        continue
+                    compiler = cc + flags + ['-DEXTERN_C=']
+                funcs = disassemble(compiler, self.objdump, source,
+                                    self.tmpdir, cplusplus=cplusplus)
+                self.compare_probes(funcs, '%s %s: %s'
+                                           % (name, lang, compat_body))
+
+    def test_newref(self):
+        self.check_shim_probe('PyObject*', 'PyObject *obj',
+                              'return Py_NewRef(obj);',
+                              'Py_INCREF(obj); return obj;')
+
+    def test_xnewref(self):
+        self.check_shim_probe('PyObject*', 'PyObject *obj',
+                              'return Py_XNewRef(obj);',
+                              'Py_XINCREF(obj); return obj;')
+
+    def test_is(self):
+        self.check_shim_probe('int', 'PyObject *x, PyObject *y',
+                              'return Py_Is(x, y);',
+                              'return (x == y);')
+        self.check_shim_probe('int', 'PyObject *obj',
+                              'return Py_IsNone(obj);',
+                              'return (obj == Py_None);')
+        self.check_shim_probe('int', 'PyObject *obj',
+                              'return Py_IsTrue(obj);',
+                              'return (obj == Py_True);')
+        self.check_shim_probe('int', 'PyObject *obj',
+                              'return Py_IsFalse(obj);',
+                              'return (obj == Py_False);')
+
+    def test_set_size(self):
+        self.check_shim_probe('void', 'PyVarObject *ob, Py_ssize_t size',
+                              'Py_SET_SIZE(ob, size);',
+                              'ob->ob_size = size;')
+
+    @unittest.skipIf(sys.version_info >= (3, 12),
+                     "Py_SET_REFCNT() doesn't modify immortal objects")
+    def test_set_refcnt(self):
+        self.check_shim_probe('void', 'PyObject *obj, Py_ssize_t refcnt',
+                              'Py_SET_REFCNT(obj, refcnt);',
+                              'obj->ob_refcnt = refcnt;')
+
+    def test_vectorcall_nargs(self):
+        self.check_shim_probe(
+            'Py_ssize_t', 'size_t nargsf',
+            'return PyVectorcall_NARGS(nargsf);',
+            'return (Py_ssize_t)(nargsf & ~PY_VECTORCALL_ARGUMENTS_OFFSET);')
+
+    @unittest.skipIf(sys.version_info >= (3, 11) or PYPY,
+                     "need the PyFrameObject structure")
+    def test_frame_getcode_borrow(self):
+        self.check_probe('PyCodeObject*', 'PyFrameObject *frame',
+                         '_PyFrame_GetCodeBorrow(frame)',
+                         'frame->f_code')
+
+    @unittest.skipIf(sys.version_info >= (3, 11) or PYPY,
+                     "need the PyFrameObject structure")
+    def test_frame_getback_borrow(self):
+        self.check_probe('PyFrameObject*', 'PyFrameObject *frame',
+                         '_PyFrame_GetBackBorrow(frame)',
+                         'frame->f_back')
+
+    @unittest.skipIf(sys.version_info >= (3, 11) or PYPY,
+                     "need the PyThreadState.frame member")
+    def test_threadstate_getframe_borrow(self):
+        self.check_probe('PyFrameObject*', 'PyThreadState *tstate',
+                         '_PyThreadState_GetFrameBorrow(tstate)',
+                         'tstate->frame')
+
+    # pythoncapi_compat.hpp requires C++11 which is only supported by the
+    # Python headers on Python 3.6 and newer
+    @unittest.skipIf(sys.version_info < (3, 6),
+                     "need Python 3.6 or newer")
+    def test_ref_move(self):
+        # Moving a Ref must not emit reference count operations
+        self.check_cxx_probe(
+            'PyObject*', 'PyObject *obj',
+            'pycompat::Ref<> ref = pycompat::Ref<>::steal(obj); '
+            'pycompat::Ref<> moved(std::move(ref)); '
+            'pycompat::Ref<> assigned; '
+            'assigned = std::move(moved); '
+            'return assigned.release();',
+            'return obj;')
+
+    @unittest.skipIf(sys.version_info < (3, 6),
+                     "need Python 3.6 or newer")
+    def test_borrowed_ref(self):
+        self.check_cxx_probe(
+            'PyObject*', 'PyObject *obj',
+            'pycompat::BorrowedRef<> ref(obj); '
+            'pycompat::BorrowedRef<> copy = ref; '
+            'return copy.get();',
+            'return obj;')
+
+
+VERBOSE = False
+
+
+if __name__ == "__main__":
+    if '-v' in sys.argv or '--verbose' in sys.argv:
+        VERBOSE = True
+    unittest.main()
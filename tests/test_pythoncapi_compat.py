@@ -14,6 +14,7 @@ import os.path
 import shutil
 import subprocess
 import sys
+import sysconfig
 try:
     import faulthandler
 except ImportError:
@@ -26,9 +27,12 @@ from utils import run_command, command_stdout
 
 TESTS = [
     ("test_pythoncapi_compat_cext", "C"),
+    ("test_pythoncapi_compat_optext", "C opt-in"),
     ("test_pythoncapi_compat_cppext", "C++"),
     ("test_pythoncapi_compat_cpp03ext", "C++03"),
     ("test_pythoncapi_compat_cpp11ext", "C++11"),
+    ("test_pythoncapi_compat_cpp17ext", "C++17"),
+    ("test_pythoncapi_compat_cpp20ext", "C++20"),
 ]
 
 VERBOSE = False
@@ -109,6 +113,22 @@ def _check_refleak(test_func, verbose):
             raise AssertionError("refcnt leak, diff: %s" % diff)
 
 
+def _run_subinterp_tests(module_name, testmod):
+    # Run test_hpp() in more subinterpreters than PYCOMPAT_NAME() cache
+    # entries: each interpreter has its own interned strings
+    if not hasattr(testmod, 'test_hpp'):
+        return
+    try:
+        from _testcapi import run_in_subinterp
+    except ImportError:
+        return
+    code = ("import sys; sys.path.append(%r); import %s as mod; mod.test_hpp()"
+            % (os.path.dirname(testmod.__file__), module_name))
+    for _ in range(6):
+        if run_in_subinterp(code) != 0:
+            raise Exception("test_hpp() failed in a subinterpreter")
+
+
 def python_version():
     ver = sys.version_info
     build = 'debug' if hasattr(sys, 'gettotalrefcount') else 'release'
@@ -123,13 +143,19 @@ def python_version():
             python_impl = "PyPy"
         else:
             python_impl = 'Python'
-    return "%s %s.%s (%s build)" % (python_impl, ver.major, ver.minor, build)
+    if sysconfig.get_config_var('Py_GIL_DISABLED'):
+        build = '%s build, free-threading' % build
+    else:
+        build = '%s build' % build
+    return "%s %s.%s (%s)" % (python_impl, ver.major, ver.minor, build)
 
 
 def run_tests(module_name, lang):
     title = "Test %s (%s)" % (module_name, lang)
     display_title(title)
 
+    gil_disabled = (sysconfig.get_config_var('Py_GIL_DISABLED')
+                    and not sys._is_gil_enabled())
     try:
         testmod = import_tests(module_name)
     except ImportError:
@@ -143,6 +169,11 @@ def run_tests(module_name, lang):
             print()
         return
 
+    # Importing the extension must not enable the GIL: it declares that it
+    # doesn't need it
+    if gil_disabled and sys._is_gil_enabled():
+        raise Exception("importing %s enabled the GIL" % module_name)
+
     if VERBOSE and hasattr(testmod, "__cplusplus"):
         print("__cplusplus: %s" % testmod.__cplusplus)
 
@@ -159,6 +190,7 @@ def run_tests(module_name, lang):
         _check_refleak(test_func, VERBOSE)
     else:
         test_func()
+    _run_subinterp_tests(module_name, testmod)
 
     if VERBOSE:
         print()
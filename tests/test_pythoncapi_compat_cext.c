@@ -2,6 +2,11 @@
 #undef NDEBUG
 
 #include "pythoncapi_compat.h"
+#include "pythread.h"                // PyThread_start_new_thread()
+#if defined(__cplusplus) && __cplusplus >= 201103
+#  include "pythoncapi_compat.hpp"
+#  include <utility>              // std::move()
+#endif
 
 #ifdef NDEBUG
 #  error "assertions must be enabled"
@@ -15,8 +20,14 @@
 #  define PYTHON3 1
 #endif
 
-#if defined(_MSC_VER) && defined(__cplusplus)
+#if defined(MODULE_NAME)
+   // Set by setup.py
+#elif defined(_MSC_VER) && defined(__cplusplus)
 #  define MODULE_NAME test_pythoncapi_compat_cppext
+#elif defined(__cplusplus) && __cplusplus >= 202002
+#  define MODULE_NAME test_pythoncapi_compat_cpp20ext
+#elif defined(__cplusplus) && __cplusplus >= 201703
+#  define MODULE_NAME test_pythoncapi_compat_cpp17ext
 #elif defined(__cplusplus) && __cplusplus >= 201103
 #  define MODULE_NAME test_pythoncapi_compat_cpp11ext
 #elif defined(__cplusplus)
@@ -199,6 +210,104 @@ test_frame_getvar(PyFrameObject *frame)
 }
 
 
+static void
+check_frame_var(PyFrameObject *frame, const char *name, long expected)
+{
+    PyObject *value = PyFrame_GetVarString(frame, name);
+    if (expected >= 0) {
+        assert(value != _Py_NULL);
+        assert(PyLong_AsLong(value) == expected);
+        Py_DECREF(value);
+    }
+    else {
+        assert(value == _Py_NULL);
+        assert(PyErr_ExceptionMatches(PyExc_NameError));
+        PyErr_Clear();
+    }
+}
+
+
+// Test PyFrame_GetVar() on local, cell and free variables
+static void
+test_frame_getvar_closure(void)
+{
+    const char *code =
+        "def outer(a):\n"
+        "    b = 2\n"
+        "    def gen(c, d):\n"
+        "        def inner():\n"
+        "            return d\n"
+        "        yield a + b + c\n"
+        "        unbound = 5\n"
+        "    return gen(3, 4)\n";
+
+    PyObject *globals = PyDict_New();
+    assert(globals != _Py_NULL);
+    assert(PyDict_SetItemString(globals, "__builtins__",
+                                PyEval_GetBuiltins()) == 0);
+    PyObject *res = PyRun_String(code, Py_file_input, globals, globals);
+    assert(res != _Py_NULL);
+    Py_DECREF(res);
+
+    PyObject *outer = PyDict_GetItemString(globals, "outer");
+    assert(outer != _Py_NULL);
+    PyObject *gen = PyObject_CallFunction(outer, "i", 1);
+    Py_DECREF(globals);
+    assert(gen != _Py_NULL);
+    PyObject *frame = PyObject_GetAttrString(gen, "gi_frame");
+    assert(frame != _Py_NULL);
+    assert(PyFrame_Check(frame));
+    PyFrameObject *gen_frame = (PyFrameObject*)frame;
+
+    check_frame_var(gen_frame, "a", 1);  // free variable
+    check_frame_var(gen_frame, "b", 2);  // free variable
+    check_frame_var(gen_frame, "c", 3);  // local variable
+    check_frame_var(gen_frame, "d", 4);  // argument and cell variable
+    check_frame_var(gen_frame, "inner", -1);  // unbound local variable
+    check_frame_var(gen_frame, "unbound", -1);  // unbound local variable
+
+    Py_DECREF(frame);
+    Py_DECREF(gen);
+}
+
+
+// Test PyCompat_CaptureStack(): compare to PyFrame_GetBack()
+static void
+test_capture_stack(PyThreadState *tstate)
+{
+    PyCompat_StackEntry entries[64];
+    PyFrameObject *frame = PyThreadState_GetFrame(tstate);
+    assert(frame != _Py_NULL);
+    Py_ssize_t frame_refcnt = Py_REFCNT(frame);
+
+    int depth = PyCompat_CaptureStack(tstate, entries, 64);
+    assert(1 <= depth && depth < 64);
+    assert(Py_REFCNT(frame) == frame_refcnt);
+
+    int i = 0;
+    while (frame != _Py_NULL) {
+        assert(i < depth);
+        PyCodeObject *code = PyFrame_GetCode(frame);
+        assert(entries[i].code == code);
+        Py_DECREF(code);
+        assert(entries[i].lasti == PyFrame_GetLasti(frame));
+
+        PyFrameObject *back = PyFrame_GetBack(frame);
+        Py_DECREF(frame);
+        frame = back;
+        i++;
+    }
+    assert(i == depth);
+
+    // Truncated stack
+    entries[1].code = _Py_NULL;
+    assert(PyCompat_CaptureStack(tstate, entries, 1) == 1);
+    assert(entries[0].code != _Py_NULL);
+    assert(entries[1].code == _Py_NULL);
+    assert(PyCompat_CaptureStack(tstate, entries, 0) == 0);
+}
+
+
 static PyObject *
 test_frame(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 {
@@ -277,6 +386,10 @@ test_frame(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 
     // test PyFrame_GetVar() and PyFrame_GetVarString()
     test_frame_getvar(frame);
+    test_frame_getvar_closure();
+
+    // test PyCompat_CaptureStack()
+    test_capture_stack(tstate);
 
     // done
     Py_DECREF(frame);
@@ -332,6 +445,58 @@ test_interpreter(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 }
 
 
+#ifdef PYTHON3
+static PyObject *
+test_raised_exception(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
+{
+    PyObject *exc, *globals, *res, *type, *value, *tb;
+
+    // test PyErr_GetRaisedException() and PyErr_SetRaisedException()
+    // without exception
+    assert(!PyErr_Occurred());
+    assert(PyErr_GetRaisedException() == _Py_NULL);
+    PyErr_SetRaisedException(_Py_NULL);
+    assert(!PyErr_Occurred());
+
+    // test PyErr_GetRaisedException(): the exception is normalized
+    PyErr_SetString(PyExc_ValueError, "error");
+    exc = PyErr_GetRaisedException();
+    assert(exc != _Py_NULL);
+    assert(!PyErr_Occurred());
+    assert(PyObject_TypeCheck(exc, _Py_CAST(PyTypeObject*, PyExc_ValueError)));
+
+    // test PyErr_SetRaisedException(): steal a reference to exc
+    PyErr_SetRaisedException(exc);
+    assert(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+
+    // test that the traceback is attached to the exception
+    globals = PyDict_New();
+    assert(globals != _Py_NULL);
+    res = PyRun_String("1 / 0", Py_eval_input, globals, globals);
+    assert(res == _Py_NULL);
+    Py_DECREF(globals);
+    exc = PyErr_GetRaisedException();
+    assert(PyObject_TypeCheck(exc,
+                              _Py_CAST(PyTypeObject*, PyExc_ZeroDivisionError)));
+    tb = PyException_GetTraceback(exc);
+    assert(tb != _Py_NULL);
+    Py_DECREF(tb);
+
+    // test that PyErr_SetRaisedException() restores the traceback
+    PyErr_SetRaisedException(exc);
+    PyErr_Fetch(&type, &value, &tb);
+    assert(type == PyExc_ZeroDivisionError);
+    assert(value == exc);
+    assert(tb != _Py_NULL);
+    PyErr_Restore(type, value, tb);
+    PyErr_Clear();
+
+    Py_RETURN_NONE;
+}
+#endif
+
+
 static PyObject *
 test_calls(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 {
@@ -533,6 +698,75 @@ error:
 
 
 #if (PY_VERSION_HEX <= 0x030B00A1 || 0x030B00A7 <= PY_VERSION_HEX) && !defined(PYPY_VERSION)
+// Compare PyCompat_Float_PackArrayN() and PyCompat_Float_UnpackArrayN() to
+// PyFloat_PackN() and PyFloat_UnpackN()
+static void
+test_float_pack_array(void)
+{
+    const double values[] = {1.5, -0.0, 0.1, 1e-310, 65504.0,
+                             Py_HUGE_VAL, -Py_HUGE_VAL, Py_NAN};
+    const Py_ssize_t n = (Py_ssize_t)(sizeof(values) / sizeof(values[0]));
+    char packed[sizeof(values)];
+    char expected[sizeof(values)];
+    double unpacked[sizeof(values) / sizeof(values[0])];
+    double too_big[2] = {1.0, 1e300};
+
+    for (int le = 0; le <= 1; le++) {
+#if PY_VERSION_HEX >= 0x030600B1
+        assert(PyCompat_Float_PackArray2(values, packed, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            assert(PyFloat_Pack2(values[i], expected + i * 2, le) == 0);
+        }
+        assert(memcmp(packed, expected, (size_t)n * 2) == 0);
+        assert(PyCompat_Float_UnpackArray2(packed, unpacked, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            double x = PyFloat_Unpack2(packed + i * 2, le);
+            assert(memcmp(&unpacked[i], &x, sizeof(x)) == 0);
+        }
+#endif
+
+        assert(PyCompat_Float_PackArray4(values, packed, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            assert(PyFloat_Pack4(values[i], expected + i * 4, le) == 0);
+        }
+        assert(memcmp(packed, expected, (size_t)n * 4) == 0);
+        assert(PyCompat_Float_UnpackArray4(packed, unpacked, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            double x = PyFloat_Unpack4(packed + i * 4, le);
+            assert(memcmp(&unpacked[i], &x, sizeof(x)) == 0);
+        }
+
+        assert(PyCompat_Float_PackArray8(values, packed, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            assert(PyFloat_Pack8(values[i], expected + i * 8, le) == 0);
+        }
+        assert(memcmp(packed, expected, (size_t)n * 8) == 0);
+        assert(PyCompat_Float_UnpackArray8(packed, unpacked, n, le) == 0);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            double x = PyFloat_Unpack8(packed + i * 8, le);
+            assert(memcmp(&unpacked[i], &x, sizeof(x)) == 0);
+        }
+
+        // Empty array and negative size: do nothing
+        memcpy(expected, packed, sizeof(packed));
+        assert(PyCompat_Float_PackArray8(values, packed, 0, le) == 0);
+        assert(PyCompat_Float_PackArray8(values, packed, -1, le) == 0);
+        assert(memcmp(packed, expected, sizeof(packed)) == 0);
+        assert(PyCompat_Float_UnpackArray8(packed, unpacked, -1, le) == 0);
+
+        // Overflow
+#if PY_VERSION_HEX >= 0x030600B1
+        assert(PyCompat_Float_PackArray2(too_big, packed, 2, le) == -1);
+        assert(PyErr_ExceptionMatches(PyExc_OverflowError));
+        PyErr_Clear();
+#endif
+        assert(PyCompat_Float_PackArray4(too_big, packed, 2, le) == -1);
+        assert(PyErr_ExceptionMatches(PyExc_OverflowError));
+        PyErr_Clear();
+    }
+}
+
+
 static PyObject *
 test_float_pack(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 {
@@ -583,12 +817,69 @@ test_float_pack(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
     assert(PyFloat_Unpack4("\x00\x00\xc0?", little_endian) == d);
     assert(PyFloat_Unpack8("\x00\x00\x00\x00\x00\x00\xf8?", little_endian) == d);
 
+    test_float_pack_array();
+
     Py_RETURN_NONE;
 }
 #endif
 
 
 #if !defined(PYPY_VERSION)
+// Compare PyCompat_Code_Addr2Line() to PyCode_Addr2Line() on all offsets
+static void
+check_code_addr2line(PyCodeObject *code)
+{
+    PyObject *co_code = PyCode_GetCode(code);
+    assert(co_code != _Py_NULL);
+    int size = (int)PyBytes_GET_SIZE(co_code);
+    Py_DECREF(co_code);
+
+    // The second loop uses the cached line table
+    for (int loop = 0; loop < 2; loop++) {
+        for (int addr = 0; addr < size; addr += _PyCompat_CODE_UNIT) {
+            assert(PyCompat_Code_Addr2Line(code, addr)
+                   == PyCode_Addr2Line(code, addr));
+        }
+        assert(PyCompat_Code_Addr2Line(code, -1) == code->co_firstlineno);
+        assert(PyCompat_Code_Addr2Line(code, size) == -1);
+    }
+}
+
+
+static void
+test_code_addr2line(void)
+{
+    const char *source =
+        "def func(x):\n"
+        "    y = 0\n"
+        "\n"
+        "    for i in range(x):\n"
+        "        y += i\n"
+        "        if y > 10:\n"
+        "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"
+        "            break\n"
+        "    return y\n";
+
+    PyObject *module_code = Py_CompileString(source, "<addr2line>",
+                                             Py_file_input);
+    assert(module_code != _Py_NULL);
+    assert(PyCode_Check(module_code));
+    check_code_addr2line((PyCodeObject*)module_code);
+
+    PyObject *consts = ((PyCodeObject*)module_code)->co_consts;
+    int found = 0;
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(consts); i++) {
+        PyObject *item = PyTuple_GET_ITEM(consts, i);
+        if (PyCode_Check(item)) {
+            check_code_addr2line((PyCodeObject*)item);
+            found = 1;
+        }
+    }
+    assert(found);
+    Py_DECREF(module_code);
+}
+
+
 static PyObject *
 test_code(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
 {
@@ -635,6 +926,61 @@ test_code(PyObject *Py_UNUSED(module), PyObject* Py_UNUSED(ignored))
         Py_DECREF(co_freevars);
     }
 
+#if 0x030600B1 <= PY_VERSION_HEX
+    // PyUnstable_Code_GetExtra(), PyUnstable_Code_SetExtra()
+    {
+        Py_ssize_t index = PyUnstable_Eval_RequestCodeExtraIndex(_Py_NULL);
+        assert(index >= 0);
+        void *extra = Py_None;  // marker value
+        assert(PyUnstable_Code_GetExtra((PyObject*)code, index, &extra) == 0);
+        assert(extra == _Py_NULL);
+        assert(PyUnstable_Code_SetExtra((PyObject*)code, index, code) == 0);
+        assert(PyUnstable_Code_GetExtra((PyObject*)code, index, &extra) == 0);
+        assert(extra == code);
+        assert(PyUnstable_Code_SetExtra((PyObject*)code, index, _Py_NULL) == 0);
+    }
+#endif
+
+    // PyCompat_Code_GetCode(), PyCompat_Code_GetVarnames(),
+    // PyCompat_Code_GetCellvars(), PyCompat_Code_GetFreevars()
+    {
+        PyObject* (*getters[4])(PyCodeObject *) = {
+            PyCompat_Code_GetCode,
+            PyCompat_Code_GetVarnames,
+            PyCompat_Code_GetCellvars,
+            PyCompat_Code_GetFreevars,
+        };
+        PyObject* (*ref_getters[4])(PyCodeObject *) = {
+            PyCode_GetCode,
+            PyCode_GetVarnames,
+            PyCode_GetCellvars,
+            PyCode_GetFreevars,
+        };
+        for (int i = 0; i < 4; i++) {
+            PyObject *obj = getters[i](code);
+            assert(obj != _Py_NULL);
+            // The second call returns the cached object
+            PyObject *obj2 = getters[i](code);
+            assert(obj2 == obj);
+            PyObject *ref = ref_getters[i](code);
+            assert(ref != _Py_NULL);
+            assert(PyObject_RichCompareBool(obj, ref, Py_EQ) == 1);
+            Py_DECREF(ref);
+            Py_DECREF(obj2);
+            Py_DECREF(obj);
+        }
+    }
+
+    // PyCompat_Code_Addr2Line()
+    {
+        int lasti = PyFrame_GetLasti(frame);
+        assert(PyCompat_Code_Addr2Line(code, lasti)
+               == PyCode_Addr2Line(code, lasti));
+        assert(PyCompat_Code_Addr2Line(code, lasti)
+               == PyFrame_GetLineNumber(frame));
+        test_code_addr2line();
+    }
+
     Py_DECREF(code);
     Py_DECREF(frame);
     Py_RETURN_NONE;
@@ -711,6 +1057,210 @@ test_api_casts(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
 }
 
 
+#if defined(__cplusplus) && __cplusplus >= 201103
+// Test pycompat::call() of pythoncapi_compat.hpp
+static void
+test_hpp_call(PyObject *module)
+{
+    pycompat::Ref<> func = pycompat::Ref<>::steal(
+        PyObject_GetAttrString(module, "func_varargs"));
+    assert(func);
+
+    // No argument
+    pycompat::Ref<> res = pycompat::call(func);
+    assert(res);
+    assert(PyTuple_GET_SIZE(res.get()) == 1);
+    assert(PyTuple_GET_SIZE(PyTuple_GET_ITEM(res.get(), 0)) == 0);
+
+    // Positional and keyword arguments: pass PyObject*, Ref and BorrowedRef
+    pycompat::Ref<> one = pycompat::Ref<>::steal(PyLong_FromLong(1));
+    assert(one);
+    for (int i=0; i < 2; i++) {
+        // The second iteration uses the cached keyword names
+        res = pycompat::call(func.get(), one,
+                             pycompat::Ref<>::steal(PyLong_FromLong(2)),
+                             pycompat::kw("x", one.borrow()),
+                             pycompat::kw("y", Py_None));
+        assert(res);
+        assert(PyTuple_GET_SIZE(res.get()) == 2);
+        PyObject *posargs = PyTuple_GET_ITEM(res.get(), 0);
+        assert(PyTuple_GET_SIZE(posargs) == 2);
+        assert(PyLong_AsLong(PyTuple_GET_ITEM(posargs, 0)) == 1);
+        assert(PyLong_AsLong(PyTuple_GET_ITEM(posargs, 1)) == 2);
+        PyObject *kwargs = PyTuple_GET_ITEM(res.get(), 1);
+        assert(PyDict_Size(kwargs) == 2);
+        assert(PyDict_GetItemString(kwargs, "x") == one.get());
+        assert(PyDict_GetItemString(kwargs, "y") == Py_None);
+    }
+
+    // Only keyword arguments
+    res = pycompat::call(func, pycompat::kw("z", one));
+    assert(res);
+    assert(PyTuple_GET_SIZE(PyTuple_GET_ITEM(res.get(), 0)) == 0);
+    assert(PyDict_GetItemString(PyTuple_GET_ITEM(res.get(), 1), "z") == one.get());
+
+    // Two call sites with the same argument types but different keyword
+    // names: the names of the second call site are not cached
+    for (int i=0; i < 2; i++) {
+        res = pycompat::call(func, pycompat::kw("a", one));
+        assert(res);
+        assert(PyDict_GetItemString(PyTuple_GET_ITEM(res.get(), 1), "a") == one.get());
+        res = pycompat::call(func, pycompat::kw("b", one));
+        assert(res);
+        assert(PyDict_GetItemString(PyTuple_GET_ITEM(res.get(), 1), "b") == one.get());
+    }
+
+    // PYCOMPAT_CALL(): each call site has its own cache
+    for (int i=0; i < 2; i++) {
+        res = PYCOMPAT_CALL(func, one, pycompat::kw("c", Py_None));
+        assert(res);
+        assert(PyTuple_GET_SIZE(PyTuple_GET_ITEM(res.get(), 0)) == 1);
+        assert(PyDict_GetItemString(PyTuple_GET_ITEM(res.get(), 1), "c") == Py_None);
+        res = PYCOMPAT_CALL(func, one, pycompat::kw("d", Py_None));
+        assert(res);
+        assert(PyDict_GetItemString(PyTuple_GET_ITEM(res.get(), 1), "d") == Py_None);
+    }
+    res = PYCOMPAT_CALL(func);
+    assert(res);
+    assert(PyTuple_GET_SIZE(PyTuple_GET_ITEM(res.get(), 0)) == 0);
+
+    // NULL argument
+    PyErr_SetString(PyExc_ValueError, "error");
+    res = pycompat::call(func, one, pycompat::Ref<>());
+    assert(!res);
+    assert(PyErr_ExceptionMatches(PyExc_ValueError));
+    PyErr_Clear();
+}
+
+
+static PyObject*
+get_hpp_name(void)
+{
+    return PYCOMPAT_NAME("test_hpp_name");
+}
+
+
+// Test PYCOMPAT_NAME() and pycompat::name<>() of pythoncapi_compat.hpp
+static void
+test_hpp_name(PyObject *module)
+{
+    PyObject *name = get_hpp_name();
+    assert(name != _Py_NULL);
+    assert(PyUnicode_CheckExact(name));
+    assert(PyUnicode_CompareWithASCIIString(name, "test_hpp_name") == 0);
+    // The same object is returned at each call
+    assert(get_hpp_name() == name);
+    // Each call site has its own cache, but strings are interned
+    assert(PYCOMPAT_NAME("test_hpp_name") == name);
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+    assert(pycompat::name<"test_hpp_name">() == name);
+    assert(pycompat::name<"test_hpp_name">() == name);
+#endif
+
+    PyObject *value;
+    int res = PyObject_GetOptionalAttr(module, PYCOMPAT_NAME("__name__"),
+                                       &value);
+    assert(res == 1);
+    assert(PyUnicode_CompareWithASCIIString(value, MODULE_NAME_STR) == 0);
+    Py_DECREF(value);
+}
+
+
+// Test pythoncapi_compat.hpp
+static PyObject *
+test_hpp(PyObject *module, PyObject *Py_UNUSED(args))
+{
+    PyObject *obj = PyList_New(0);
+    if (obj == _Py_NULL) {
+        return _Py_NULL;
+    }
+#ifdef CHECK_REFCNT
+    Py_ssize_t refcnt = Py_REFCNT(obj);
+#endif
+
+    {
+        // steal() doesn't increment the reference count
+        pycompat::Ref<> ref = pycompat::Ref<>::steal(Py_NewRef(obj));
+        assert(ref.get() == obj);
+        assert(ref);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 1);
+
+        // Moves transfer the ownership
+        pycompat::Ref<> moved(std::move(ref));
+        assert(!ref);
+        assert(moved.get() == obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 1);
+
+        ref = std::move(moved);
+        assert(!moved);
+        assert(ref.get() == obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 1);
+
+        // copy() and new_ref() create new strong references
+        pycompat::Ref<> copy = ref.copy();
+        assert(copy.get() == obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 2);
+
+        pycompat::BorrowedRef<> borrowed = copy.borrow();
+        pycompat::BorrowedRef<> borrowed2 = borrowed;
+        assert(borrowed2.get() == obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 2);
+
+        pycompat::Ref<> ref2 = borrowed2.new_ref();
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 3);
+        ref2.reset();
+        assert(!ref2);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 2);
+
+        ref2 = pycompat::Ref<>::new_ref(obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 3);
+
+        // release() gives the strong reference to the caller
+        PyObject *raw = copy.release();
+        assert(!copy);
+        assert(raw == obj);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 3);
+        Py_DECREF(raw);
+
+        // Moving into a non-empty reference releases the old object
+        ref2 = std::move(ref);
+        ASSERT_REFCNT(Py_REFCNT(obj) == refcnt + 1);
+    }
+    ASSERT_REFCNT(Py_REFCNT(obj) == refcnt);
+
+#ifndef PYPY_VERSION
+    {
+        // Reference to a PyObject subtype
+        PyFrameObject *frame = PyEval_GetFrame();
+        if (frame != _Py_NULL) {
+            pycompat::Ref<PyCodeObject> code =
+                pycompat::Ref<PyCodeObject>::steal(PyFrame_GetCode(frame));
+            assert(code);
+            assert(PyCode_Check(code.get()));
+        }
+    }
+#endif
+
+    {
+        // NULL references
+        pycompat::Ref<> ref;
+        assert(!ref);
+        assert(ref.release() == _Py_NULL);
+        pycompat::BorrowedRef<> borrowed = nullptr;
+        assert(!borrowed);
+        assert(!borrowed.new_ref());
+    }
+
+    test_hpp_call(module);
+    test_hpp_name(module);
+
+    Py_DECREF(obj);
+    Py_RETURN_NONE;
+}
+#endif
+
+
 static PyObject *
 test_import(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
 {
@@ -997,6 +1547,70 @@ test_vectorcall(PyObject *module, PyObject *Py_UNUSED(args))
 }
 
 
+// Test PyObject_GetOptionalAttr() on a type using PyObject_GenericGetAttr()
+static void
+test_getattr_generic(void)
+{
+    PyObject *attr_name;
+    PyObject *value;
+
+    // Create a heap type with a class attribute, a slot and a __dict__
+    PyObject *type = PyObject_CallFunction((PyObject*)&PyType_Type,
+                                           "s(){sis(ss)}", "TypeName",
+                                           "class_attr", 1,
+                                           "__slots__", "slot", "__dict__");
+    assert(type != _Py_NULL);
+    PyObject *obj = PyObject_CallNoArgs(type);
+    Py_DECREF(type);
+    assert(obj != _Py_NULL);
+    PyObject *inst_value = create_string("value");
+    assert(PyObject_SetAttrString(obj, "inst_attr", inst_value) == 0);
+
+    // test PyObject_GetOptionalAttr(): instance attribute
+    attr_name = create_string("inst_attr");
+    value = Py_True;  // marker value
+    assert(PyObject_GetOptionalAttr(obj, attr_name, &value) == 1);
+    assert(value == inst_value);
+    Py_DECREF(value);
+    Py_DECREF(attr_name);
+
+    // test PyObject_GetOptionalAttr(): class attribute
+    attr_name = create_string("class_attr");
+    value = Py_True;  // marker value
+    assert(PyObject_GetOptionalAttr(obj, attr_name, &value) == 1);
+    check_int(value, 1);
+    Py_DECREF(value);
+    Py_DECREF(attr_name);
+
+    // test PyObject_GetOptionalAttr(): the slot descriptor raises
+    // AttributeError since the slot is not set
+    attr_name = create_string("slot");
+    value = Py_True;  // marker value
+    assert(PyObject_GetOptionalAttr(obj, attr_name, &value) == 0);
+    assert(value == _Py_NULL);
+    assert(!PyErr_Occurred());
+    Py_DECREF(attr_name);
+
+    // test PyObject_GetOptionalAttr(): attribute doesn't exist
+    attr_name = create_string("nonexistant_attr_name");
+    value = Py_True;  // marker value
+    assert(PyObject_GetOptionalAttr(obj, attr_name, &value) == 0);
+    assert(value == _Py_NULL);
+    assert(!PyErr_Occurred());
+    Py_DECREF(attr_name);
+
+    // test PyObject_HasAttrStringWithError()
+    assert(PyObject_HasAttrStringWithError(obj, "inst_attr") == 1);
+    assert(PyObject_HasAttrStringWithError(obj, "class_attr") == 1);
+    assert(PyObject_HasAttrStringWithError(obj, "slot") == 0);
+    assert(PyObject_HasAttrStringWithError(obj, "nonexistant_attr_name") == 0);
+    assert(!PyErr_Occurred());
+
+    Py_DECREF(inst_value);
+    Py_DECREF(obj);
+}
+
+
 static PyObject *
 test_getattr(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
 {
@@ -1037,11 +1651,80 @@ test_getattr(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
     assert(value == _Py_NULL);
     assert(!PyErr_Occurred());
 
+    // test PyObject_HasAttrWithError()
+    attr_name = create_string("version");
+    assert(PyObject_HasAttrWithError(obj, attr_name) == 1);
+    Py_DECREF(attr_name);
+    attr_name = create_string("nonexistant_attr_name");
+    assert(PyObject_HasAttrWithError(obj, attr_name) == 0);
+    assert(!PyErr_Occurred());
+    Py_DECREF(attr_name);
+
+    // test PyObject_HasAttrStringWithError()
+    assert(PyObject_HasAttrStringWithError(obj, "version") == 1);
+    assert(PyObject_HasAttrStringWithError(obj, "nonexistant_attr_name") == 0);
+    assert(!PyErr_Occurred());
+
+    // test PyObject_HasAttrWithError(): invalid attribute name
+    assert(PyObject_HasAttrWithError(obj, Py_None) == -1);
+    assert(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+
     Py_DECREF(obj);
+
+    test_getattr_generic();
     Py_RETURN_NONE;
 }
 
 
+// Test PyMapping_GetOptionalItem() on dict subclasses
+static void
+test_getitem_dict_subclass(void)
+{
+    PyObject *key = create_string("key");
+    PyObject *item;
+
+    // dict subclass which doesn't define __missing__()
+    PyObject *type = PyObject_CallFunction((PyObject*)&PyType_Type,
+                                           "s(O){}", "DictSubclass",
+                                           (PyObject*)&PyDict_Type);
+    assert(type != _Py_NULL);
+    PyObject *obj = PyObject_CallNoArgs(type);
+    Py_DECREF(type);
+    assert(obj != _Py_NULL);
+
+    item = Py_True;  // marker value
+    assert(PyMapping_GetOptionalItem(obj, key, &item) == 0);
+    assert(item == _Py_NULL);
+    assert(!PyErr_Occurred());
+
+    assert(PyDict_SetItem(obj, key, Py_None) == 0);
+    item = Py_True;  // marker value
+    assert(PyMapping_GetOptionalItem(obj, key, &item) == 1);
+    assert(item == Py_None);
+    Py_DECREF(item);
+    Py_DECREF(obj);
+
+    // collections.defaultdict defines __missing__()
+    PyObject *collections = PyImport_ImportModule("collections");
+    assert(collections != _Py_NULL);
+    obj = PyObject_CallMethod(collections, "defaultdict", "O",
+                              (PyObject*)&PyList_Type);
+    Py_DECREF(collections);
+    assert(obj != _Py_NULL);
+
+    item = _Py_NULL;
+    assert(PyMapping_GetOptionalItem(obj, key, &item) == 1);
+    assert(item != _Py_NULL);
+    assert(PyList_CheckExact(item));
+    Py_DECREF(item);
+    assert(PyDict_Size(obj) == 1);
+    Py_DECREF(obj);
+
+    Py_DECREF(key);
+}
+
+
 static PyObject *
 test_getitem(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
 {
@@ -1080,8 +1763,21 @@ test_getitem(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
     assert(PyMapping_GetOptionalItemString(obj, "dontexist", &item) == 0);
     assert(item == _Py_NULL);
 
+    // test PyMapping_GetOptionalItem(): unhashable key
+    key = PyList_New(0);
+    assert(key != _Py_NULL);
+    item = Py_True;  // marker value
+    assert(PyMapping_GetOptionalItem(obj, key, &item) == -1);
+    assert(item == _Py_NULL);
+    assert(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+    Py_DECREF(key);
+
     Py_DECREF(obj);
     Py_DECREF(value);
+
+    test_getitem_dict_subclass();
+
     Py_RETURN_NONE;
 }
 
@@ -1148,6 +1844,16 @@ test_dict_getitemref(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
     assert(!PyErr_Occurred());
     assert(get_value == NULL);
 
+    // test PyDict_GetItemStringRef(), the C string is modified between calls
+    char key_str[4];
+    memcpy(key_str, "kez", 4);
+    assert(PyDict_GetItemStringRef(dict, key_str, &get_value) == 0);
+    assert(get_value == NULL);
+    memcpy(key_str, "key", 4);
+    assert(PyDict_GetItemStringRef(dict, key_str, &get_value) == 1);
+    assert(get_value == value);
+    Py_DECREF(get_value);
+
     // test PyDict_GetItemRef(), invalid dict
     invalid_dict = key;  // borrowed reference
     get_value = Py_Ellipsis;  // marker value
@@ -1193,6 +1899,477 @@ error:
 }
 
 
+// Create a dict key type: keys have the same hash and their __eq__() method
+// inserts an item into the dict
+static PyObject*
+create_dict_mutating_key(PyObject *dict, const char *name)
+{
+    const char *code =
+        "class Key:\n"
+        "    def __init__(self, dct, name):\n"
+        "        self.dct = dct\n"
+        "        self.name = name\n"
+        "    def __hash__(self):\n"
+        "        return 1\n"
+        "    def __eq__(self, other):\n"
+        "        if 'mutated' not in self.dct:\n"
+        "            self.dct['mutated'] = True\n"
+        "        return self.name == other.name\n";
+
+    PyObject *globals = PyDict_New();
+    assert(globals != _Py_NULL);
+    assert(PyDict_SetItemString(globals, "__builtins__",
+                                PyEval_GetBuiltins()) == 0);
+    PyObject *res = PyRun_String(code, Py_file_input, globals, globals);
+    assert(res != _Py_NULL);
+    Py_DECREF(res);
+
+    PyObject *key_type = PyDict_GetItemString(globals, "Key");
+    assert(key_type != _Py_NULL);
+    PyObject *key = PyObject_CallFunction(key_type, "Os", dict, name);
+    assert(key != _Py_NULL);
+    Py_DECREF(globals);
+    return key;
+}
+
+
+static PyObject *
+test_dict_pop(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
+{
+    PyObject *dict = PyDict_New();
+    assert(dict != NULL);
+    PyObject *key = PyUnicode_FromString("key");
+    assert(key != NULL);
+    PyObject *value = PyUnicode_FromString("value");
+    assert(value != NULL);
+    PyObject *result;
+
+    // test PyDict_Pop(), key is present
+    assert(PyDict_SetItem(dict, key, value) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(dict, key, &result) == 1);
+    assert(result == value);
+    Py_DECREF(result);
+    assert(PyDict_Size(dict) == 0);
+
+    // test PyDict_Pop(), missing key
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(dict, key, &result) == 0);
+    assert(!PyErr_Occurred());
+    assert(result == NULL);
+
+    // test PyDict_Pop(), result is NULL
+    assert(PyDict_SetItem(dict, key, value) == 0);
+    assert(PyDict_Pop(dict, key, NULL) == 1);
+    assert(PyDict_Pop(dict, key, NULL) == 0);
+    assert(!PyErr_Occurred());
+
+    // test PyDict_Pop(), the dict is its own value
+    assert(PyDict_SetItem(dict, key, dict) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(dict, key, &result) == 1);
+    assert(result == dict);
+    Py_DECREF(result);
+    assert(PyDict_Size(dict) == 0);
+
+    // test PyDict_PopString()
+    assert(PyDict_SetItemString(dict, "key", value) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_PopString(dict, "key", &result) == 1);
+    assert(result == value);
+    Py_DECREF(result);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_PopString(dict, "key", &result) == 0);
+    assert(!PyErr_Occurred());
+    assert(result == NULL);
+
+    // test PyDict_Pop(), invalid dict
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(key, key, &result) == -1);
+    assert(PyErr_ExceptionMatches(PyExc_SystemError));
+    PyErr_Clear();
+    assert(result == NULL);
+
+    // test PyDict_Pop(), invalid key
+    PyObject *invalid_key = PyList_New(0);  // not hashable key
+    assert(invalid_key != NULL);
+    assert(PyDict_SetItem(dict, key, value) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(dict, invalid_key, &result) == -1);
+    assert(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+    assert(result == NULL);
+    Py_DECREF(invalid_key);
+
+    // test PyDict_Pop(), missing key and the key comparison mutates the dict
+    PyDict_Clear(dict);
+    PyObject *key1 = create_dict_mutating_key(dict, "a");
+    PyObject *key2 = create_dict_mutating_key(dict, "b");
+    assert(PyDict_SetItem(dict, key1, dict) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_Pop(dict, key2, &result) == 0);
+    assert(!PyErr_Occurred());
+    assert(result == NULL);
+    assert(PyDict_Size(dict) == 2);
+    PyDict_Clear(dict);
+    Py_DECREF(key1);
+    Py_DECREF(key2);
+
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(value);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+test_dict_setdefaultref(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
+{
+    PyObject *dict = PyDict_New();
+    assert(dict != NULL);
+    PyObject *key = PyUnicode_FromString("key");
+    assert(key != NULL);
+    PyObject *value = PyUnicode_FromString("value");
+    assert(value != NULL);
+    PyObject *default_value = PyUnicode_FromString("default");
+    assert(default_value != NULL);
+    PyObject *result;
+
+    // test PyDict_SetDefaultRef(), missing key: insert the default value
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(dict, key, value, &result) == 0);
+    assert(result == value);
+    Py_DECREF(result);
+    assert(PyDict_Size(dict) == 1);
+
+    // test PyDict_SetDefaultRef(), key is present
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(dict, key, default_value, &result) == 1);
+    assert(result == value);
+    Py_DECREF(result);
+
+    // test PyDict_SetDefaultRef(), the default value is the present value
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(dict, key, value, &result) == 1);
+    assert(result == value);
+    Py_DECREF(result);
+
+    // test PyDict_SetDefaultRef(), result is NULL
+    assert(PyDict_SetDefaultRef(dict, key, default_value, NULL) == 1);
+    assert(PyDict_Pop(dict, key, NULL) == 1);
+    assert(PyDict_SetDefaultRef(dict, key, default_value, NULL) == 0);
+    assert(PyDict_Size(dict) == 1);
+
+    // test PyDict_SetDefaultRef(), invalid dict
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(key, key, value, &result) == -1);
+    assert(PyErr_ExceptionMatches(PyExc_SystemError));
+    PyErr_Clear();
+    assert(result == NULL);
+
+    // test PyDict_SetDefaultRef(), invalid key
+    PyObject *invalid_key = PyList_New(0);  // not hashable key
+    assert(invalid_key != NULL);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(dict, invalid_key, value, &result) == -1);
+    assert(PyErr_ExceptionMatches(PyExc_TypeError));
+    PyErr_Clear();
+    assert(result == NULL);
+    Py_DECREF(invalid_key);
+
+    // test PyDict_SetDefaultRef(), key is present and the key comparison
+    // mutates the dict
+    PyDict_Clear(dict);
+    PyObject *key1 = create_dict_mutating_key(dict, "a");
+    PyObject *key2 = create_dict_mutating_key(dict, "a");
+    assert(PyDict_SetItem(dict, key1, value) == 0);
+    result = Py_Ellipsis;  // marker value
+    assert(PyDict_SetDefaultRef(dict, key2, default_value, &result) == 1);
+    assert(result == value);
+    Py_DECREF(result);
+    assert(PyDict_Size(dict) == 2);
+    PyDict_Clear(dict);
+    Py_DECREF(key1);
+    Py_DECREF(key2);
+
+    Py_DECREF(dict);
+    Py_DECREF(key);
+    Py_DECREF(value);
+    Py_DECREF(default_value);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+test_list_getitemref(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
+{
+    PyObject *list = PyList_New(1);
+    assert(list != NULL);
+    PyList_SET_ITEM(list, 0, Py_NewRef(Py_None));
+
+    // test PyList_GetItemRef()
+    PyObject *item = PyList_GetItemRef(list, 0);
+    assert(item == Py_None);
+    Py_DECREF(item);
+
+    // test PyList_GetItemRef(), index out of range
+    assert(PyList_GetItemRef(list, 1) == NULL);
+    assert(PyErr_ExceptionMatches(PyExc_IndexError));
+    PyErr_Clear();
+    assert(PyList_GetItemRef(list, -1) == NULL);
+    assert(PyErr_ExceptionMatches(PyExc_IndexError));
+    PyErr_Clear();
+
+    Py_DECREF(list);
+    Py_RETURN_NONE;
+}
+
+
+// PyMutex requires atomic operations on Python 3.12 and older
+#if (PY_VERSION_HEX >= 0x030D00B3 || defined(__ATOMIC_ACQUIRE) \
+     || defined(_MSC_VER))
+#define MUTEX_THREADS 4
+#define MUTEX_LOOPS 10000
+
+typedef struct {
+    PyMutex mutex;
+    Py_ssize_t counter;
+    int finished;
+    // Released when all threads completed
+    PyThread_type_lock done;
+} mutex_test_data;
+
+static void
+mutex_increment(mutex_test_data *data)
+{
+    int i;
+    for (i = 0; i < MUTEX_LOOPS; i++) {
+        PyMutex_Lock(&data->mutex);
+        data->counter++;
+        PyMutex_Unlock(&data->mutex);
+    }
+}
+
+// Thread without Python thread state: don't use the Python C API
+static void
+mutex_thread(void *arg)
+{
+    mutex_test_data *data = _Py_CAST(mutex_test_data*, arg);
+    int last;
+    mutex_increment(data);
+
+    PyMutex_Lock(&data->mutex);
+    data->finished++;
+    last = (data->finished == MUTEX_THREADS);
+    PyMutex_Unlock(&data->mutex);
+    // data can be destroyed as soon as done is released
+    if (last) {
+        PyThread_release_lock(data->done);
+    }
+}
+
+typedef struct {
+    PyMutex mutex;
+    // Released when the thread completed
+    PyThread_type_lock done;
+} mutex_gil_data;
+
+// Thread without Python thread state locking a mutex held by a thread which
+// holds the GIL: PyMutex_Lock() must not release the GIL of the other thread
+static void
+mutex_gil_thread(void *arg)
+{
+    mutex_gil_data *data = _Py_CAST(mutex_gil_data*, arg);
+    PyMutex_Lock(&data->mutex);
+    PyMutex_Unlock(&data->mutex);
+    PyThread_release_lock(data->done);
+}
+
+static void
+test_mutex_gil(void)
+{
+    mutex_gil_data data;
+    long thread_id;
+
+    memset(&data, 0, sizeof(data));
+    data.done = PyThread_allocate_lock();
+    assert(data.done != _Py_NULL);
+    assert(PyThread_acquire_lock(data.done, WAIT_LOCK) == 1);
+
+    PyMutex_Lock(&data.mutex);
+    thread_id = _Py_CAST(long,
+        PyThread_start_new_thread(mutex_gil_thread, &data));
+    assert(thread_id != -1);
+#if PY_VERSION_HEX >= 0x03020000
+    // Hold the GIL and the mutex for 100 ms: the thread waits for the mutex
+    assert(PyThread_acquire_lock_timed(data.done, 100 * 1000, 0)
+           == PY_LOCK_FAILURE);
+#endif
+    PyMutex_Unlock(&data.mutex);
+
+    Py_BEGIN_ALLOW_THREADS
+    (void)PyThread_acquire_lock(data.done, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(data.done);
+    PyThread_free_lock(data.done);
+}
+
+static PyObject *
+test_mutex(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
+{
+    static PyMutex static_mutex;
+    PyMutex mutex = {0};
+    mutex_test_data data;
+    int i;
+
+    // Uncontended mutex
+    PyMutex_Lock(&static_mutex);
+    PyMutex_Unlock(&static_mutex);
+    PyMutex_Lock(&mutex);
+    PyMutex_Unlock(&mutex);
+    PyMutex_Lock(&mutex);
+    PyMutex_Unlock(&mutex);
+
+    // Contended mutex: the main thread holds the GIL while it locks the
+    // mutex, the other threads don't hold the GIL
+    memset(&data, 0, sizeof(data));
+    data.done = PyThread_allocate_lock();
+    assert(data.done != _Py_NULL);
+    assert(PyThread_acquire_lock(data.done, WAIT_LOCK) == 1);
+    for (i = 0; i < MUTEX_THREADS; i++) {
+        long thread_id = _Py_CAST(long,
+            PyThread_start_new_thread(mutex_thread, &data));
+        assert(thread_id != -1);
+    }
+    mutex_increment(&data);
+
+    Py_BEGIN_ALLOW_THREADS
+    (void)PyThread_acquire_lock(data.done, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(data.done);
+    PyThread_free_lock(data.done);
+
+    PyMutex_Lock(&data.mutex);
+    assert(data.counter == (MUTEX_THREADS + 1) * MUTEX_LOOPS);
+    PyMutex_Unlock(&data.mutex);
+
+    test_mutex_gil();
+
+    Py_RETURN_NONE;
+}
+#endif
+
+
+static PyObject *
+test_critical_section(PyObject *module, PyObject *Py_UNUSED(args))
+{
+    PyObject *list = PyList_New(0);
+    assert(list != _Py_NULL);
+    PyObject *dict = PyDict_New();
+    assert(dict != _Py_NULL);
+
+    Py_BEGIN_CRITICAL_SECTION(list);
+    assert(PyList_Append(list, Py_None) == 0);
+    Py_END_CRITICAL_SECTION();
+
+    Py_BEGIN_CRITICAL_SECTION2(list, dict);
+    assert(PyDict_SetItemString(dict, "list", list) == 0);
+    Py_END_CRITICAL_SECTION2();
+
+    // The same object twice
+    Py_BEGIN_CRITICAL_SECTION2(list, list);
+    assert(PyList_GET_SIZE(list) == 1);
+    Py_END_CRITICAL_SECTION2();
+
+    // Nested critical sections
+    Py_BEGIN_CRITICAL_SECTION(dict);
+    Py_BEGIN_CRITICAL_SECTION(list);
+    assert(PyList_Append(list, dict) == 0);
+    Py_END_CRITICAL_SECTION();
+    Py_END_CRITICAL_SECTION();
+    assert(PyList_GET_SIZE(list) == 2);
+
+    // Break the reference cycle
+    assert(PyDict_DelItemString(dict, "list") == 0);
+    Py_DECREF(dict);
+    Py_DECREF(list);
+
+    // The module doesn't need the GIL
+    assert(PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED) == 0);
+
+    Py_RETURN_NONE;
+}
+
+
+#ifdef PYTHONCAPI_COMPAT_STATS
+static void
+check_stat(const char *name, Py_ssize_t calls, Py_ssize_t slow)
+{
+    PyObject *stats = PyCompat_GetStats();
+    assert(stats != _Py_NULL);
+    assert(PyDict_Check(stats));
+    PyObject *value = PyDict_GetItemString(stats, name);
+    assert(value != _Py_NULL);
+    assert(PyTuple_Check(value) && PyTuple_GET_SIZE(value) == 2);
+    assert(PyNumber_AsSsize_t(PyTuple_GET_ITEM(value, 0), _Py_NULL) == calls);
+    assert(PyNumber_AsSsize_t(PyTuple_GET_ITEM(value, 1), _Py_NULL) == slow);
+    Py_DECREF(stats);
+}
+
+
+static PyObject *
+test_stats(PyObject *Py_UNUSED(module), PyObject *Py_UNUSED(args))
+{
+    PyCompat_ResetStats();
+    check_stat("PyMapping_GetOptionalItem", 0, 0);
+    check_stat("PyObject_Vectorcall", 0, 0);
+
+    // gh-106307 added PyMapping_GetOptionalItem() to Python 3.13.0a1
+#if PY_VERSION_HEX < 0x030D00A1
+    PyObject *dict = PyDict_New();
+    assert(dict != _Py_NULL);
+#ifdef PYTHON3
+    PyObject *key = PyUnicode_FromString("key");
+#else
+    PyObject *key = PyString_FromString("key");
+#endif
+    assert(key != _Py_NULL);
+    PyObject *value;
+
+    // dict: fast path
+    assert(PyMapping_GetOptionalItem(dict, key, &value) == 0);
+    assert(value == _Py_NULL);
+    check_stat("PyMapping_GetOptionalItem", 1, 0);
+
+    // mappingproxy: slow path
+    PyObject *proxy = PyDictProxy_New(dict);
+    assert(proxy != _Py_NULL);
+    assert(PyMapping_GetOptionalItem(proxy, key, &value) == 0);
+    assert(value == _Py_NULL);
+    check_stat("PyMapping_GetOptionalItem", 2, 1);
+    Py_DECREF(proxy);
+
+    Py_DECREF(key);
+    Py_DECREF(dict);
+#endif
+
+#if PY_VERSION_HEX < 0x030D00B3
+    {
+        // Uncontended PyMutex_Lock() takes the fast path
+        PyMutex mutex = {0};
+        PyMutex_Lock(&mutex);
+        PyMutex_Unlock(&mutex);
+        check_stat("PyMutex_Lock", 1, 0);
+    }
+#endif
+
+    PyCompat_ResetStats();
+    check_stat("PyMapping_GetOptionalItem", 0, 0);
+    Py_RETURN_NONE;
+}
+#endif
+
+
 static struct PyMethodDef methods[] = {
     {"test_object", test_object, METH_NOARGS, _Py_NULL},
     {"test_py_is", test_py_is, METH_NOARGS, _Py_NULL},
@@ -1201,6 +2378,9 @@ static struct PyMethodDef methods[] = {
 #endif
     {"test_thread_state", test_thread_state, METH_NOARGS, _Py_NULL},
     {"test_interpreter", test_interpreter, METH_NOARGS, _Py_NULL},
+#ifdef PYTHON3
+    {"test_raised_exception", test_raised_exception, METH_NOARGS, _Py_NULL},
+#endif
     {"test_calls", test_calls, METH_NOARGS, _Py_NULL},
     {"test_gc", test_gc, METH_NOARGS, _Py_NULL},
     {"test_module", test_module, METH_NOARGS, _Py_NULL},
@@ -1211,6 +2391,9 @@ static struct PyMethodDef methods[] = {
     {"test_code", test_code, METH_NOARGS, _Py_NULL},
 #endif
     {"test_api_casts", test_api_casts, METH_NOARGS, _Py_NULL},
+#if defined(__cplusplus) && __cplusplus >= 201103
+    {"test_hpp", test_hpp, METH_NOARGS, _Py_NULL},
+#endif
     {"test_import", test_import, METH_NOARGS, _Py_NULL},
     {"test_weakref", test_weakref, METH_NOARGS, _Py_NULL},
     {"func_varargs", (PyCFunction)(void*)func_varargs, METH_VARARGS | METH_KEYWORDS, _Py_NULL},
@@ -1218,6 +2401,17 @@ static struct PyMethodDef methods[] = {
     {"test_getattr", test_getattr, METH_NOARGS, _Py_NULL},
     {"test_getitem", test_getitem, METH_NOARGS, _Py_NULL},
     {"test_dict_getitemref", test_dict_getitemref, METH_NOARGS, _Py_NULL},
+    {"test_dict_pop", test_dict_pop, METH_NOARGS, _Py_NULL},
+    {"test_dict_setdefaultref", test_dict_setdefaultref, METH_NOARGS, _Py_NULL},
+    {"test_list_getitemref", test_list_getitemref, METH_NOARGS, _Py_NULL},
+    {"test_critical_section", test_critical_section, METH_NOARGS, _Py_NULL},
+#if (PY_VERSION_HEX >= 0x030D00B3 || defined(__ATOMIC_ACQUIRE) \
+     || defined(_MSC_VER))
+    {"test_mutex", test_mutex, METH_NOARGS, _Py_NULL},
+#endif
+#ifdef PYTHONCAPI_COMPAT_STATS
+    {"test_stats", test_stats, METH_NOARGS, _Py_NULL},
+#endif
     {_Py_NULL, _Py_NULL, 0, _Py_NULL}
 };
 
@@ -1243,6 +2437,9 @@ module_exec(PyObject *Py_UNUSED(module))
 #if PY_VERSION_HEX >= 0x03050000
 static PyModuleDef_Slot module_slots[] = {
     {Py_mod_exec, _Py_CAST(void*, module_exec)},
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
     {0, _Py_NULL}
 };
 #endif
@@ -924,6 +924,113 @@ class Tests(unittest.TestCase):
             }
         """)
 
+    def test_pyerr_getraisedexception(self):
+        self.check_replace("""
+            int call(PyObject *obj)
+            {
+                PyObject *exc_type, *exc_value, *exc_tb;
+                int res;
+
+                PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+                res = PyObject_IsTrue(obj);
+                PyErr_Restore(exc_type, exc_value, exc_tb);
+                return res;
+            }
+        """, """
+            #include "pythoncapi_compat.h"
+
+            int call(PyObject *obj)
+            {
+                PyObject *exc_value;
+                int res;
+
+                exc_value = PyErr_GetRaisedException();
+                res = PyObject_IsTrue(obj);
+                PyErr_SetRaisedException(exc_value);
+                return res;
+            }
+        """)
+
+        # Declaration order differs from PyErr_Fetch() arguments, initialized
+        # variables, nested block, multiple pairs
+        self.check_replace("""
+            void call(PyObject *obj)
+            {
+                if (obj != NULL) {
+                    PyObject *tb = NULL, *type = NULL, *value = NULL;
+                    PyErr_Fetch(&type, &value, &tb);
+                    PyObject_CallNoArgs(obj);
+                    PyErr_Restore(type, value, tb);
+
+                    PyErr_Fetch(&type, &value, &tb);
+                    PyObject_CallNoArgs(obj);
+                    PyErr_Restore(type, value, tb);
+                }
+            }
+        """, """
+            #include "pythoncapi_compat.h"
+
+            void call(PyObject *obj)
+            {
+                if (obj != NULL) {
+                    PyObject *value = NULL;
+                    value = PyErr_GetRaisedException();
+                    PyObject_CallNoArgs(obj);
+                    PyErr_SetRaisedException(value);
+
+                    value = PyErr_GetRaisedException();
+                    PyObject_CallNoArgs(obj);
+                    PyErr_SetRaisedException(value);
+                }
+            }
+        """, disable="Py_Is")
+
+        # Don't replace if a variable is used by other code
+        self.check_dont_replace("""
+            void call(PyObject *obj)
+            {
+                PyObject *type, *value, *tb;
+                PyErr_Fetch(&type, &value, &tb);
+                PyErr_NormalizeException(&type, &value, &tb);
+                PyErr_Restore(type, value, tb);
+            }
+        """)
+        self.check_dont_replace("""
+            void call(PyObject *obj)
+            {
+                PyObject *type, *value, *tb;
+                PyErr_Fetch(&type, &value, &tb);
+                if (type == PyExc_KeyError) {
+                    PyErr_Clear();
+                }
+                PyErr_Restore(type, value, tb);
+            }
+        """)
+
+        # Don't replace without PyErr_Restore()
+        self.check_dont_replace("""
+            void call(PyObject *obj)
+            {
+                PyObject *type, *value, *tb;
+                PyErr_Fetch(&type, &value, &tb);
+                Py_XDECREF(type);
+                Py_XDECREF(value);
+                Py_XDECREF(tb);
+            }
+        """)
+
+        # Excluded from "all": require Python 3
+        source = reformat("""
+            void call(PyObject *obj)
+            {
+                PyObject *type, *value, *tb;
+                PyErr_Fetch(&type, &value, &tb);
+                PyErr_Restore(type, value, tb);
+            }
+        """)
+        self.assertEqual(patch(source, disable="PyErr_GetRaisedException"),
+                         source)
+
 
     def test_no_compat(self):
         # Don't add "#include "pythoncapi_compat.h"
@@ -941,5 +1048,151 @@ class Tests(unittest.TestCase):
         """
         self.check_replace(source, expected, no_compat=True)
 
+    def check_prune(self, source, expected, min_python=(3, 8), no_pypy=True):
+        source = reformat(source) + '\n'
+        expected = reformat(expected) + '\n'
+        pruned = upgrade_pythoncapi.prune_header(source, min_python, no_pypy)
+        self.assertEqual(pruned, expected)
+
+    def test_evaluate_condition(self):
+        evaluator = upgrade_pythoncapi.ConditionEvaluator((3, 8), True)
+        for expr, value in (
+            ('PY_VERSION_HEX >= 0x03000000', True),
+            ('PY_VERSION_HEX >= 0x03080000', True),
+            ('PY_VERSION_HEX >= 0x030800B1', None),
+            ('PY_VERSION_HEX < 0x03080000', False),
+            ('PY_VERSION_HEX < 0x030900A4', None),
+            ('0x030600B1 <= PY_VERSION_HEX', True),
+            ('0x030900B1 <= PY_VERSION_HEX', None),
+            ('!defined(PYPY_VERSION)', True),
+            ('PY_VERSION_HEX < 0x030900A4 && !defined(PYPY_VERSION)', None),
+            ('PY_VERSION_HEX < 0x030600B1 || defined(PYPY_VERSION)', False),
+            ('(PY_VERSION_HEX < 0x03050200 && !defined(Py_SETREF)) '
+             '&& !defined(Py_LIMITED_API)', False),
+            ('defined(__cplusplus) && __cplusplus >= 201103', None),
+            ('defined(Py_LIMITED_API) || defined(PYPY_VERSION)', None),
+            ('0', False),
+            ('1  // comment', True),
+            # Unsupported syntax
+            ('PY_VERSION_HEX + 1 >= 0x03000000', None),
+        ):
+            with self.subTest(expr=expr):
+                self.assertIs(evaluator.evaluate(expr), value)
+
+        evaluator = upgrade_pythoncapi.ConditionEvaluator((2, 7), False)
+        self.assertIsNone(evaluator.evaluate('PY_VERSION_HEX >= 0x03000000'))
+        self.assertIsNone(evaluator.evaluate('!defined(PYPY_VERSION)'))
+
+    def test_prune_header(self):
+        # Remove the dead branch and the comment before a removed block
+        self.check_prune("""
+            int x;
+
+            // Py_Func() was added to Python 3.0
+            #if PY_VERSION_HEX < 0x03000000
+            void Py_Func(void) {}
+            #endif
+
+            #if PY_VERSION_HEX >= 0x03000000
+            int py3;
+            #else
+            int py2;
+            #endif
+        """, """
+            int x;
+
+
+            int py3;
+        """)
+
+        # Keep conditions which depend on the build unchanged
+        self.check_prune("""
+            #if PY_VERSION_HEX < 0x030900A4 && !defined(PYPY_VERSION)
+            int old;
+            #else
+            int new;
+            #endif
+            #ifdef __cplusplus
+            extern "C" {
+            #endif
+        """, """
+            #if PY_VERSION_HEX < 0x030900A4 && !defined(PYPY_VERSION)
+            int old;
+            #else
+            int new;
+            #endif
+            #ifdef __cplusplus
+            extern "C" {
+            #endif
+        """)
+
+        # Remove nested blocks of a dead branch
+        self.check_prune("""
+            #if defined(PYPY_VERSION)
+            #  if PY_VERSION_HEX >= 0x030900A4
+            int pypy39;
+            #  endif
+            int pypy;
+            #elif PY_VERSION_HEX < 0x030B0000 \\
+                  && PY_VERSION_HEX >= 0x03000000
+            int cpython;
+            #else
+            int cpython311;
+            #endif
+        """, """
+            #if PY_VERSION_HEX < 0x030B0000 \\
+                  && PY_VERSION_HEX >= 0x03000000
+            int cpython;
+            #else
+            int cpython311;
+            #endif
+        """)
+
+        # An #elif which is always true replaces the next branches
+        self.check_prune("""
+            #if defined(Py_LIMITED_API)
+            int limited;
+            #elif PY_VERSION_HEX >= 0x03000000
+            int py3;
+            #else
+            int py2;
+            #endif
+        """, """
+            #if defined(Py_LIMITED_API)
+            int limited;
+            #else
+            int py3;
+            #endif
+        """)
+
+        # Nothing to remove with the default options
+        self.check_prune("""
+            #if PY_VERSION_HEX >= 0x03000000 && !defined(PYPY_VERSION)
+            int py3;
+            #endif
+        """, """
+            #if PY_VERSION_HEX >= 0x03000000 && !defined(PYPY_VERSION)
+            int py3;
+            #endif
+        """, min_python=(2, 7), no_pypy=False)
+
+    def test_prune_pythoncapi_compat(self):
+        filename = os.path.join(os.path.dirname(__file__), '..',
+                                'pythoncapi_compat.h')
+        with open(filename, encoding="utf-8") as fp:
+            source = fp.read()
+
+        # Python 2.7 with PyPy: the header is unchanged
+        pruned = upgrade_pythoncapi.prune_header(source, (2, 7), False)
+        self.assertEqual(pruned, source)
+
+        pruned_pypy = upgrade_pythoncapi.prune_header(source, (3, 8), False)
+        pruned = upgrade_pythoncapi.prune_header(source, (3, 8), True)
+        self.assertLess(len(pruned_pypy), len(source))
+        self.assertLess(len(pruned), len(pruned_pypy))
+        self.assertNotIn('PyString_FromString', pruned)
+        # Opt-in macros are kept
+        self.assertIn('PYTHONCAPI_COMPAT_FAST_LOCALS', pruned)
+
 if __name__ == "__main__":
     unittest.main()
@@ -460,6 +460,89 @@ class Py_Is(Operation):
     NEED_PYTHONCAPI_COMPAT = (MIN_PYTHON < (3, 10))
 
 
+# Match "PyObject *exc_value" and "PyObject *exc_value = NULL"
+ERR_VAR_REGEX = fr'\* *({ID_REGEX})( *= *NULL)?'
+
+
+class PyErr_GetRaisedException(Operation):
+    NAME = "PyErr_GetRaisedException"
+    # Need PyErr_GetRaisedException(): new in Python 3.12
+    NEED_PYTHONCAPI_COMPAT = (MIN_PYTHON < (3, 12))
+
+    # "PyObject *type, *value, *tb;" declaration
+    DECL_REGEX = re.compile(fr'^({SPACE_REGEX}*)PyObject *'
+                            fr'{ERR_VAR_REGEX} *, *'
+                            fr'{ERR_VAR_REGEX} *, *'
+                            fr'{ERR_VAR_REGEX} *;',
+                            re.MULTILINE)
+    # "PyErr_Fetch(&type, &value, &tb);"
+    FETCH_REGEX = re.compile(fr'PyErr_Fetch\( *& *({ID_REGEX}) *, '
+                             fr'*& *({ID_REGEX}) *, *& *({ID_REGEX}) *\) *;')
+    # "}" at the beginning of a line
+    BLOCK_END_REGEX = re.compile(fr'^({SPACE_REGEX}*)}}', re.MULTILINE)
+
+    def scope_end(self, content, pos, indent):
+        # Return the position of the "}" closing the block of the declaration
+        # at pos: the first "}" line less indented than the declaration.
+        for match in self.BLOCK_END_REGEX.finditer(content, pos):
+            if len(match.group(1)) < len(indent):
+                return match.start()
+        return None
+
+    def patch_scope(self, scope, names):
+        # Replace PyErr_Fetch() and PyErr_Restore() calls of the scope.
+        # Return (new scope, value variable), or None if the variables are
+        # used by other code.
+        for match in self.FETCH_REGEX.finditer(scope):
+            if set(match.groups()) == set(names):
+                type_name, value_name, tb_name = match.groups()
+                break
+        else:
+            return None
+        fetch_regex = re.compile(fr'PyErr_Fetch\( *& *{type_name} *, '
+                                 fr'*& *{value_name} *, *& *{tb_name} *\) *;')
+        restore_regex = re.compile(fr'PyErr_Restore\( *{type_name} *, '
+                                   fr'*{value_name} *, *{tb_name} *\) *;')
+        if not restore_regex.search(scope):
+            return None
+        other_code = restore_regex.sub('', fetch_regex.sub('', scope))
+        for name in names:
+            if re.search(fr'\b{name}\b', other_code):
+                return None
+
+        scope = fetch_regex.sub(f'{value_name} = PyErr_GetRaisedException();',
+                                scope)
+        scope = restore_regex.sub(f'PyErr_SetRaisedException({value_name});',
+                                  scope)
+        return (scope, value_name)
+
+    def patch(self, content):
+        old_content = content
+        pos = 0
+        while True:
+            match = self.DECL_REGEX.search(content, pos)
+            if match is None:
+                break
+            pos = match.end()
+            indent = match.group(1)
+            names = (match.group(2), match.group(4), match.group(6))
+            end = self.scope_end(content, pos, indent)
+            if end is None or len(set(names)) != 3:
+                continue
+            result = self.patch_scope(content[pos:end], names)
+            if result is None:
+                continue
+            new_scope, value_name = result
+            init = match.group(names.index(value_name) * 2 + 3) or ''
+            decl = f'{indent}PyObject *{value_name}{init};'
+            content = (content[:match.start()] + decl + new_scope
+                       + content[end:])
+            pos = match.start() + len(decl)
+
+        if content != old_content and self.NEED_PYTHONCAPI_COMPAT:
+            content = self.patcher.add_pythoncapi_compat(content)
+        return content
+
 OPERATIONS = (
     Py_SET_TYPE,
     Py_SET_SIZE,
@@ -481,6 +564,9 @@ OPERATIONS = (
     PyThreadState_GetInterpreter,
     PyThreadState_GetFrame,
 
+    # Require Python 3: excluded from "all"
+    PyErr_GetRaisedException,
+
     # Code style: excluded from "all"
     Py_NewRef,
     Py_CLEAR,
@@ -488,6 +574,7 @@ OPERATIONS = (
 )
 
 EXCLUDE_FROM_ALL = (
+    PyErr_GetRaisedException,
     Py_NewRef,
     Py_CLEAR,
     Py_SETREF,
@@ -499,6 +586,304 @@ def all_operations():
                if operation_class not in EXCLUDE_FROM_ALL)
 
 
+# Preprocessor directive: '#if', '#  elif', '#endif'
+DIRECTIVE_REGEX = re.compile(r'^(\s*#\s*)([a-z]+)\b(.*)$', re.DOTALL)
+# Token of a preprocessor expression
+PP_TOKEN_REGEX = re.compile(r'\s*(0[xX][0-9a-fA-F]+|[0-9]+|'
+                            r'[A-Za-z_][A-Za-z0-9_]*|'
+                            r'&&|\|\||[<>=!]=|[<>!()])')
+# C and C++ comments of a preprocessor directive
+PP_COMMENT_REGEX = re.compile(r'//.*$|/\*.*?\*/', re.DOTALL)
+
+
+class PyVersionHex:
+    # Value of the PY_VERSION_HEX macro: only its lower bound is known
+    def __init__(self, min_version_hex):
+        self.min = min_version_hex
+
+    def compare(self, op, value):
+        # Return True or False if "PY_VERSION_HEX op value" has the same
+        # result on all Python versions, or None
+        if op in ('<', '<='):
+            if self.min > value or (op == '<' and self.min == value):
+                return False
+        elif op in ('>', '>='):
+            if self.min > value or (op == '>=' and self.min == value):
+                return True
+        elif op == '==':
+            if self.min > value:
+                return False
+        elif op == '!=':
+            if self.min > value:
+                return True
+        return None
+
+
+def truth(value):
+    # Tri-state logic: True, False or None (unknown)
+    if value is None:
+        return None
+    if isinstance(value, PyVersionHex):
+        return True
+    return bool(value)
+
+
+class ConditionEvaluator:
+    """
+    Evaluate the condition of a preprocessor #if directive ahead of time.
+
+    evaluate() returns True or False if the condition has the same value on
+    all supported Python versions, or None if it depends on the build.
+    """
+    REVERSED_OPS = {'<': '>', '<=': '>=', '>': '<', '>=': '<=',
+                    '==': '==', '!=': '!='}
+
+    def __init__(self, min_python, no_pypy):
+        self.version = PyVersionHex((min_python[0] << 24)
+                                    | (min_python[1] << 16))
+        self.no_pypy = no_pypy
+        self.tokens = None
+        self.pos = 0
+
+    def evaluate(self, expr):
+        expr = PP_COMMENT_REGEX.sub(' ', expr).strip()
+        tokens = []
+        pos = 0
+        while pos < len(expr):
+            match = PP_TOKEN_REGEX.match(expr, pos)
+            if not match:
+                if expr[pos:].strip():
+                    # Unsupported syntax
+                    return None
+                break
+            tokens.append(match.group(1))
+            pos = match.end()
+
+        self.tokens = tokens
+        self.pos = 0
+        try:
+            value = self._parse_or()
+            if self.pos != len(self.tokens):
+                raise ValueError("unexpected token")
+        except ValueError:
+            return None
+        return truth(value)
+
+    def _peek(self):
+        if self.pos < len(self.tokens):
+            return self.tokens[self.pos]
+        return None
+
+    def _next(self):
+        token = self._peek()
+        if token is None:
+            raise ValueError("unexpected end of expression")
+        self.pos += 1
+        return token
+
+    def _parse_or(self):
+        left = self._parse_and()
+        while self._peek() == '||':
+            self._next()
+            right = truth(self._parse_and())
+            left = truth(left)
+            if left or right:
+                left = True
+            elif left is False and right is False:
+                left = False
+            else:
+                left = None
+        return left
+
+    def _parse_and(self):
+        left = self._parse_equality()
+        while self._peek() == '&&':
+            self._next()
+            right = truth(self._parse_equality())
+            left = truth(left)
+            if left is False or right is False:
+                left = False
+            elif left and right:
+                left = True
+            else:
+                left = None
+        return left
+
+    def _parse_equality(self):
+        left = self._parse_relational()
+        while self._peek() in ('==', '!='):
+            op = self._next()
+            left = self._compare(op, left, self._parse_relational())
+        return left
+
+    def _parse_relational(self):
+        left = self._parse_unary()
+        while self._peek() in ('<', '<=', '>', '>='):
+            op = self._next()
+            left = self._compare(op, left, self._parse_unary())
+        return left
+
+    def _compare(self, op, left, right):
+        if left is None or right is None:
+            return None
+        if isinstance(left, PyVersionHex):
+            if isinstance(right, PyVersionHex):
+                return None
+            return left.compare(op, right)
+        if isinstance(right, PyVersionHex):
+            return right.compare(self.REVERSED_OPS[op], left)
+        return {'<': left < right, '<=': left <= right,
+                '>': left > right, '>=': left >= right,
+                '==': left == right, '!=': left != right}[op]
+
+    def _parse_unary(self):
+        token = self._next()
+        if token == '!':
+            value = truth(self._parse_unary())
+            if value is None:
+                return None
+            return not value
+        if token == '(':
+            value = self._parse_or()
+            if self._next() != ')':
+                raise ValueError("missing )")
+            return value
+        if token == 'defined':
+            name = self._next()
+            if name == '(':
+                name = self._next()
+                if self._next() != ')':
+                    raise ValueError("missing )")
+            if name == 'PYPY_VERSION' and self.no_pypy:
+                return False
+            return None
+        if token == 'PY_VERSION_HEX':
+            return self.version
+        if token[0].isdigit():
+            return int(token, 0)
+        # Unknown macro or unsupported operator
+        if token[0].isalpha() or token[0] == '_':
+            return None
+        raise ValueError(f"unsupported token: {token!r}")
+
+
+class ConditionalBlock:
+    # State of a '#if ... #elif ... #else ... #endif' block
+    def __init__(self, active, start):
+        # Is the code around the block emitted?
+        self.active = active
+        # Number of emitted lines before the block
+        self.start = start
+        # Is the code of the current branch emitted?
+        self.live = False
+        # Is a previous branch always taken?
+        self.taken = False
+        # Are the block directives emitted?
+        self.emitted = False
+
+
+def prune_header(content, min_python, no_pypy):
+    """
+    Remove the dead code of a header file: branches of #if directives which
+    cannot be taken on Python min_python and newer (and on PyPy if no_pypy
+    is true).
+
+    Conditions which depend on the build (Python version newer than
+    min_python, compiler, opt-in macros) are kept unchanged.
+    """
+    evaluator = ConditionEvaluator(min_python, no_pypy)
+    lines = content.splitlines(keepends=True)
+    output = []
+    stack = []
+
+    def is_live():
+        return (not stack) or (stack[-1].active and stack[-1].live)
+
+    index = 0
+    while index < len(lines):
+        raw = [lines[index]]
+        index += 1
+        match = DIRECTIVE_REGEX.match(raw[0])
+        if not match:
+            if is_live():
+                output.extend(raw)
+            continue
+
+        # Directive continued on the next lines
+        while raw[-1].rstrip('\r\n').endswith('\\') and index < len(lines):
+            raw.append(lines[index])
+            index += 1
+        prefix, name, expr = match.groups()
+        expr = ''.join(raw)[match.start(3):]
+        expr = re.sub(r'\\' + NEWLINE_REGEX, ' ', expr)
+
+        if name in ('if', 'ifdef', 'ifndef'):
+            block = ConditionalBlock(is_live(), len(output))
+            stack.append(block)
+            if not block.active:
+                continue
+            if name in ('ifdef', 'ifndef'):
+                expr = PP_COMMENT_REGEX.sub(' ', expr).strip()
+                expr = f'defined({expr})'
+                if name == 'ifndef':
+                    expr = '!' + expr
+            value = evaluator.evaluate(expr)
+            if value is None:
+                output.extend(raw)
+                block.emitted = True
+            block.live = (value is not False)
+            block.taken = bool(value)
+        elif name in ('elif', 'else'):
+            if not stack:
+                raise ValueError(f"#{name} without #if")
+            block = stack[-1]
+            if not block.active:
+                continue
+            if block.taken:
+                block.live = False
+                continue
+            if name == 'else':
+                value = True
+            else:
+                value = evaluator.evaluate(expr)
+
+            if value is None:
+                if block.emitted:
+                    output.extend(raw)
+                else:
+                    # First emitted branch: replace '#elif' with '#if'
+                    output.append(prefix + 'if' + ''.join(raw)[match.end(2):])
+                block.emitted = True
+            elif value and block.emitted:
+                if name == 'else':
+                    output.extend(raw)
+                else:
+                    output.append(prefix + 'else\n')
+            block.live = (value is not False)
+            block.taken = bool(value)
+        elif name == 'endif':
+            if not stack:
+                raise ValueError("#endif without #if")
+            block = stack.pop()
+            if not block.active:
+                continue
+            if block.emitted:
+                output.extend(raw)
+            elif len(output) == block.start:
+                # The whole block is removed: remove also the comment
+                # just before the block
+                while output and output[-1].lstrip().startswith('//'):
+                    output.pop()
+        elif is_live():
+            output.extend(raw)
+    if stack:
+        raise ValueError("missing #endif")
+
+    content = ''.join(output)
+    # Remove empty lines left by removed blocks
+    return re.sub(r'\n{4,}', '\n\n\n', content)
+
+
 class Patcher:
     def __init__(self, args=None):
         self.exitcode = 0
@@ -676,6 +1061,46 @@ class Patcher:
         print("If a directory is passed, search for .c and .h files "
               "in subdirectories.")
 
+    def emit_header(self, filename):
+        src_dir = os.path.dirname(os.path.abspath(__file__))
+        source = os.path.join(src_dir, PYTHONCAPI_COMPAT_H)
+        if not os.path.exists(source):
+            self.log(f"ERROR: {source} does not exist: "
+                     f"download it with --download {src_dir}")
+            sys.exit(1)
+        if os.path.exists(filename) and os.path.samefile(filename, source):
+            self.log(f"ERROR: cannot overwrite {source}")
+            sys.exit(1)
+
+        with open(source, encoding="utf-8") as fp:
+            content = fp.read()
+        min_python = self.args.min_python
+        content = prune_header(content, min_python, self.args.no_pypy)
+
+        version = '.'.join(map(str, min_python))
+        header = (f"// Generated by upgrade_pythoncapi.py for Python "
+                  f"{version} and newer")
+        if self.args.no_pypy:
+            header += ", without PyPy"
+        header += "\n// from the pythoncapi_compat.h header file.\n//\n"
+        content = header + content
+
+        with open(filename, "w", encoding="utf-8") as fp:
+            fp.write(content)
+        self.log(f"Write {PYTHONCAPI_COMPAT_H} for Python {version} "
+                 f"into {filename}")
+
+    def _parse_python_version(self, version):
+        try:
+            major, minor = map(int, version.split('.'))
+        except ValueError:
+            raise argparse.ArgumentTypeError(
+                f"invalid Python version: {version!r}")
+        if (major, minor) < MIN_PYTHON:
+            raise argparse.ArgumentTypeError(
+                f"Python {version} is not supported")
+        return (major, minor)
+
     def _parse_dir_path(self, path):
         if os.path.isdir(path):
             return path
@@ -706,11 +1131,23 @@ class Patcher:
             '-d', '--download', metavar='PATH',
             help=f'Download latest pythoncapi_compat.h file to designated PATH',
             type=self._parse_dir_path)
+        parser.add_argument(
+            '--emit-header', metavar='FILENAME',
+            help=f'Write {PYTHONCAPI_COMPAT_H} without the code unused '
+                 f'by --min-python and --no-pypy into FILENAME')
+        parser.add_argument(
+            '--min-python', metavar='X.Y',
+            default=MIN_PYTHON, type=self._parse_python_version,
+            help='Minimum Python version of --emit-header '
+                 '(default: %s)' % '.'.join(map(str, MIN_PYTHON)))
+        parser.add_argument(
+            '--no-pypy', action="store_true",
+            help="Remove the PyPy code in --emit-header")
         parser.add_argument(
             metavar='file_or_directory', dest="paths", nargs='*')
 
         args = parser.parse_args(args)
-        if not args.paths and not args.download:
+        if not args.paths and not args.download and not args.emit_header:
             self.usage(parser)
             sys.exit(1)
 
@@ -735,6 +1172,9 @@ class Patcher:
             path = self.args.download
             self.get_latest_header(path)
 
+        if self.args.emit_header:
+            self.emit_header(self.args.emit_header)
+
         if self.pythoncapi_compat_added and not self.args.quiet:
             self.log()
             self.log(f"{INCLUDE_PYTHONCAPI_COMPAT} added: you may have "